@@ -52,8 +52,9 @@ void AF_DCMotor::Initialize(AF_MotorShield* controller, uint8_t motorNum, uint8_
     _motorState.pinPWM = pinPWM;
     _motorState.pin1 = pin1;
     _motorState.pin2 = pin2;
-    
-    Run(RELEASE);
+
+    // The pins are not released here: AF_MotorShield::Begin() has either
+    // turned all outputs off already, or is keeping them after a warm start.
 }
 
 
@@ -64,6 +65,8 @@ void AF_DCMotor::Run(DCMotorMode cmd)
     
     _motorState.mode = cmd;
     
+    _controller->BeginUpdate();     // Both pins change in one transaction
+
     switch (cmd) 
     {
         case FORWARD:
@@ -86,6 +89,8 @@ void AF_DCMotor::Run(DCMotorMode cmd)
             _controller->SetPin(pin2, LOW);
             break;
     }
+
+    _controller->Commit();
 }
 
 
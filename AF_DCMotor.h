@@ -92,7 +92,7 @@ class AF_DCMotor : public IDCMotor
         uint16_t pinPWM   : 4;  // The PWM pin for the motor
         uint16_t pin1     : 4;  // Motor pin 1
         uint16_t pin2     : 4;  // Motor pin 2
-        uint16_t mode     : 2;  // Current motor mode (one of the DCMotorMode enum values)
+        uint16_t mode     : 3;  // Current motor mode (one of the DCMotorMode enum values, 1 - 4)
         uint16_t speed    : 8;  // Current speed of the motor
     }
     _motorState;
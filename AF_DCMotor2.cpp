@@ -57,27 +57,29 @@ void AF_DCMotor2::Run(int16_t speed)
 
     speed = constrain(speed, -255, 255);
 
-    // If direction changed then reconfigure motor
-    if (SIGN(_speed) != SIGN(speed))
+    _controller->BeginUpdate();     // Direction and speed go out in one transaction
+
+    // Set the direction pins. Pins that did not change are dropped by the
+    // driver's register cache, so this costs nothing unless the direction
+    // changed (or the board was turned off with AllOff()).
+    if (speed > 0)                       // Going forward
+    {
+        _controller->SetPin(pin2, LOW);  // take pin 2 low first to avoid 'brake'
+        _controller->SetPin(pin1, HIGH);
+    }
+    else if (speed < 0)                  // Going backward
+    {
+        _controller->SetPin(pin1, LOW);  // take pin 1 low first to avoid 'brake'
+        _controller->SetPin(pin2, HIGH);
+    }
+    else                                 // Stopped
     {
-        if (speed > 0)                       // Going forward
-        {
-            _controller->SetPin(pin2, LOW);  // take pin 2 low first to avoid 'brake'
-            _controller->SetPin(pin1, HIGH);
-        }
-        else if (speed < 0)                  // Going backward
-        {
-            _controller->SetPin(pin1, LOW);  // take pin 1 low first to avoid 'brake'
-            _controller->SetPin(pin2, HIGH);
-        }
-        else                                 // Stopped
-        {
-            _controller->SetPin(pin1, LOW);  // Take both pins low to disable motor
-            _controller->SetPin(pin2, LOW);
-        }
+        _controller->SetPin(pin1, LOW);  // Take both pins low to disable motor
+        _controller->SetPin(pin2, LOW);
     }
     
     // Finally, set the motor speed
     _speed = speed;
     _controller->SetPWM(_motorState.pinPWM, abs(_speed) * 16);   // convert speed to range 0-4096 for PWM
+    _controller->Commit();
 }
@@ -0,0 +1,343 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#define DEBUG 0
+
+#if (ARDUINO >= 100)
+ #include <Arduino.h>
+#else
+ #include <WProgram.h>
+#endif
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
+#include <RTL_Stdlib.h>
+#include "AF_GCode.h"
+
+
+DEFINE_CLASSNAME(AF_GCode);
+
+
+// Letters of the axes, in the order the motors were added
+static const char _axisLetters[] = "XYZA";
+
+
+AF_GCode::AF_GCode(AF_MotionQueue& queue, Stream& stream) : _queue(queue), _stream(stream)
+{
+    for (uint8_t i=0; i < AF_MULTI_STEPPER_AXES; i++)
+    {
+        _stepsPerUnit[i] = 1;
+        _position[i] = 0;
+    }
+
+    _feed = 0;
+    _length = 0;
+    _received = false;
+    _comment = false;
+    _lineComment = false;
+    _overflow = false;
+    _pending = false;
+    _dwelling = false;
+}
+
+
+bool AF_GCode::Service(void)
+{
+    _queue.Service();
+
+    // A command that had to wait is tried again before more is read, so the
+    // lines are run, and answered, in order
+    if (_pending && Execute()) _pending = false;
+
+    while (!_pending && _stream.available() > 0)
+    {
+        char c = _stream.read();
+
+        if (c != '\n' && c != '\r')
+        {
+            Receive(c);
+            continue;
+        }
+
+        // A CR LF ends one line, not two
+        if (!_received) continue;
+
+        _line[_length] = 0;
+
+        if (_overflow)
+            Error(F("line too long"));
+        else if (Parse())
+            _pending = !Execute();
+
+        _length = 0;
+        _received = false;
+        _comment = false;
+        _lineComment = false;
+        _overflow = false;
+    }
+
+    return _pending || _queue.IsRunning();
+}
+
+
+void AF_GCode::Receive(char c)
+{
+    _received = true;
+
+    if (_lineComment) return;
+
+    if (_comment)
+    {
+        if (c == ')') _comment = false;
+        return;
+    }
+
+    if (c == ';')
+        _lineComment = true;
+    else if (c == '(')
+        _comment = true;
+    else if (isspace(c))
+        return;
+    else if (_length < AF_GCODE_LINE_LENGTH)
+        _line[_length++] = toupper(c);
+    else
+        _overflow = true;
+}
+
+
+bool AF_GCode::Parse(void)
+{
+    const char* p = _line;
+
+    _letter = 0;
+    _code = 0;
+    _axes = 0;
+    _dwell = 0;
+
+    while (*p && *p != '*')             // A checksum ends the words
+    {
+        char  letter = *p++;
+        float value;
+
+        if (!Number(p, value))
+        {
+            Error(F("bad number"));
+            return false;
+        }
+
+        const char* axis = strchr(_axisLetters, letter);
+
+        if (letter == 'G' || letter == 'M')
+        {
+            // G1.5 or M17.9 are not G1 or M17
+            if (_letter != 0 || value < 0 || value > 999 || value != floor(value))
+            {
+                Error(F("bad command"));
+                return false;
+            }
+
+            _letter = letter;
+            _code = (uint16_t)value;
+        }
+        else if (axis != NULL)
+        {
+            uint8_t i = axis - _axisLetters;
+
+            if (i >= _queue.Stepper().Count())
+            {
+                Error(F("no such axis"));
+                return false;
+            }
+
+            _target[i] = value;
+            _axes |= 1 << i;
+        }
+        else if (letter == 'F')
+        {
+            if (value <= 0)
+            {
+                Error(F("bad feed rate"));
+                return false;
+            }
+
+            _feed = value;
+        }
+        else if (letter == 'P')
+        {
+            _dwell = (value > 0) ? (uint32_t)value : 0;
+        }
+        else if (letter == 'S')
+        {
+            _dwell = (value > 0) ? (uint32_t)(value * 1000) : 0;
+        }
+        else if (letter != 'N')         // Line numbers are not checked
+        {
+            Error(F("bad word"));
+            return false;
+        }
+    }
+
+    bool known;
+
+    if (_letter == 'G')
+        known = (_code == 0 || _code == 1 || _code == 4);
+    else if (_letter == 'M')
+        known = (_code == 17 || _code == 18 || _code == 114);
+    else
+        known = (_axes == 0);           // A line of only F, N or a comment
+
+    if (!known)
+    {
+        Error(F("unknown command"));
+        return false;
+    }
+
+    return true;
+}
+
+
+bool AF_GCode::Number(const char*& p, float& value)
+{
+    // Not strtod(): with the spaces left out, it would read "G0X5" as hex
+    bool negative = (*p == '-');
+
+    if (*p == '-' || *p == '+') p++;
+
+    if (!isdigit(*p) && !(*p == '.' && isdigit(p[1]))) return false;
+
+    value = 0;
+
+    while (isdigit(*p))  value = value * 10 + (*p++ - '0');
+
+    if (*p == '.')
+    {
+        float scale = 1;
+
+        p++;
+
+        while (isdigit(*p))  value += (*p++ - '0') * (scale /= 10);
+    }
+
+    if (negative) value = -value;
+
+    return true;
+}
+
+
+bool AF_GCode::Execute(void)
+{
+    AF_MultiStepper& stepper = _queue.Stepper();
+
+    if (_letter == 'G' && _code <= 1)
+    {
+        if (_queue.IsFull()) return false;
+
+        Move();
+    }
+    else if (_letter == 'G' && _code == 4)
+    {
+        if (_queue.IsRunning()) return false;
+
+        if (!_dwelling)
+        {
+            _dwelling = true;
+            _dwellStart = millis();
+        }
+
+        if (millis() - _dwellStart < _dwell) return false;
+
+        _dwelling = false;
+    }
+    else if (_letter == 'M' && _code != 114)
+    {
+        if (_queue.IsRunning()) return false;
+
+        if (_code == 17)
+            stepper.Hold();
+        else
+            stepper.Release();
+    }
+    else if (_letter == 'M')
+    {
+        for (uint8_t i=0; i < stepper.Count(); i++)
+        {
+            if (i > 0) _stream.print(' ');
+
+            _stream.print(_axisLetters[i]);
+            _stream.print(':');
+            _stream.print(stepper.Position(i) / _stepsPerUnit[i]);
+        }
+
+        _stream.println();
+    }
+
+    _stream.println(F("ok"));
+
+    return true;
+}
+
+
+void AF_GCode::Move(void)
+{
+    AF_MultiStepper& stepper = _queue.Stepper();
+    int32_t positions[AF_MULTI_STEPPER_AXES];
+    float lengthUnits2 = 0;
+    float lengthSteps2 = 0;
+
+    // With nothing queued, the path starts where the motors are
+    if (!_queue.IsRunning())
+    {
+        for (uint8_t i=0; i < stepper.Count(); i++)
+        {
+            _position[i] = stepper.Position(i) / _stepsPerUnit[i];
+        }
+    }
+
+    for (uint8_t i=0; i < stepper.Count(); i++)
+    {
+        float target = (_axes & (1 << i)) ? _target[i] : _position[i];
+        float units = target - _position[i];
+        float steps = units * _stepsPerUnit[i];
+
+        positions[i] = lround(target * _stepsPerUnit[i]);
+        lengthUnits2 += units * units;
+        lengthSteps2 += steps * steps;
+        _position[i] = target;
+    }
+
+    // The feed rate is along the path in units per minute; the queue takes
+    // steps per second
+    uint32_t speed = 0;
+
+    if (_code == 1 && _feed > 0 && lengthUnits2 > 0)
+    {
+        speed = _feed / 60 * sqrt(lengthSteps2 / lengthUnits2);
+
+        if (speed == 0) speed = 1;
+    }
+
+    TRACE(Logger(_classname_, __func__, this) << F("G") << _code << F(" speed=") << speed << endl);
+
+    _queue.MoveTo(positions, speed);
+}
+
+
+void AF_GCode::Error(const __FlashStringHelper* reason)
+{
+    _stream.print(F("error: "));
+    _stream.println(reason);
+}
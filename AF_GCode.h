@@ -0,0 +1,167 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#ifndef _AF_GCode_h_
+#define _AF_GCode_h_
+
+#if (ARDUINO >= 100)
+ #include <Arduino.h>
+#else
+ #include <WProgram.h>
+#endif
+#include <inttypes.h>
+#include <RTL_Stdlib.h>
+#include "AF_MotionQueue.h"
+
+
+// Longest line the interpreter takes, comments included. Longer lines are
+// answered with an error.
+#ifndef AF_GCODE_LINE_LENGTH
+#define AF_GCODE_LINE_LENGTH 64
+#endif
+
+//******************************************************************************
+/// Streaming interpreter for a subset of G-code, read from a serial port, that
+/// fills an AF_MotionQueue while the moves before run:
+///
+///     G0 / G1 X Y Z A F   Move in a straight line, at full speed (G0) or at
+///                         the feed rate F in units per minute (G1; F is kept
+///                         for the lines after)
+///     G4 P / S            Wait for the moves to end, then dwell P
+///                         milliseconds or S seconds
+///     M17 / M18           Wait for the moves to end, then energize or
+///                         release the motors
+///     M114                Report the current positions: X:0.00 Y:0.00 ...
+///
+/// X, Y, Z and A are the motors of the queue's AF_MultiStepper, in the order
+/// they were added, at absolute positions in units of StepsPerUnit() steps.
+/// Comments (';' to the end of the line, or in parentheses), line numbers and
+/// checksums are skipped.
+///
+/// Each line is answered with "ok" once it is taken in (moves as soon as the
+/// queue has room for them), or with "error: " and the reason. A host that
+/// sends a line after each answer keeps the queue full without overrunning
+/// the serial buffer, so the moves follow each other without a gap.
+//******************************************************************************
+class AF_GCode
+{
+    DECLARE_CLASSNAME;
+
+    /*--------------------------------------------------------------------------
+    Constructors
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Constructor. The interpreter reads the lines from 'stream' (Serial, for
+    /// instance) and answers them on it, and queues the moves on 'queue'.
+    //**************************************************************************
+    public: AF_GCode(AF_MotionQueue& queue, Stream& stream);
+
+
+    /*--------------------------------------------------------------------------
+    Public methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Reads and runs the lines that have come in, as far as the queue takes
+    /// them, and services the queue. Call it from loop() as often as possible,
+    /// instead of the queue's Service(). Returns true while a line is waiting
+    /// or moves are running.
+    //**************************************************************************
+    public: bool Service(void);
+
+
+    /*--------------------------------------------------------------------------
+    Public properties
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Gets or sets the steps of a motor per unit of the G-code positions, as
+    /// in its own Position() (1, the default, gives positions in steps).
+    //**************************************************************************
+    public: float StepsPerUnit(uint8_t axis) { return _stepsPerUnit[axis]; };
+    public: void StepsPerUnit(uint8_t axis, float steps) { _stepsPerUnit[axis] = steps; };
+
+
+    /*--------------------------------------------------------------------------
+    Internal methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Takes a character of a line, leaving out comments and spaces.
+    //**************************************************************************
+    private: void Receive(char c);
+
+    //**************************************************************************
+    /// Reads the command and its words from the line. Answers with an error
+    /// and returns false if the line is not one the interpreter runs.
+    //**************************************************************************
+    private: bool Parse(void);
+
+    //**************************************************************************
+    /// Reads a decimal number, with an optional sign, at 'p' and moves 'p'
+    /// past it. Returns false if there is none.
+    //**************************************************************************
+    private: static bool Number(const char*& p, float& value);
+
+    //**************************************************************************
+    /// Runs the command read by Parse(), and answers it. Returns false if it
+    /// has to wait: for room in the queue, or for the moves to end.
+    //**************************************************************************
+    private: bool Execute(void);
+
+    //**************************************************************************
+    /// Queues the move of a G0 or G1.
+    //**************************************************************************
+    private: void Move(void);
+
+    //**************************************************************************
+    /// Answers a line with an error.
+    //**************************************************************************
+    private: void Error(const __FlashStringHelper* reason);
+
+
+    /*--------------------------------------------------------------------------
+    Internal state
+    --------------------------------------------------------------------------*/
+
+    private: AF_MotionQueue& _queue;
+    private: Stream&  _stream;
+    private: float    _stepsPerUnit[AF_MULTI_STEPPER_AXES];
+    private: float    _position[AF_MULTI_STEPPER_AXES];  // Position the last move queued goes to, in units
+    private: float    _feed;            // Feed rate of G1 in units per minute (0 for full speed)
+
+    // The line coming in
+    private: char     _line[AF_GCODE_LINE_LENGTH + 1];
+    private: uint8_t  _length;          // Characters kept
+    private: bool     _received;        // Anything came in, comments included
+    private: bool     _comment;         // In a comment in parentheses
+    private: bool     _lineComment;     // In a comment to the end of the line
+    private: bool     _overflow;        // The line is too long
+
+    // The command waiting to run
+    private: bool     _pending;
+    private: char     _letter;          // 'G' or 'M'
+    private: uint16_t _code;
+    private: uint8_t  _axes;            // Bit mask of the axes given
+    private: float    _target[AF_MULTI_STEPPER_AXES];
+    private: uint32_t _dwell;           // G4 time in milliseconds
+    private: uint32_t _dwellStart;      // millis() at the start of the dwell
+    private: bool     _dwelling;
+};
+
+#endif
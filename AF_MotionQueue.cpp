@@ -0,0 +1,248 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#define DEBUG 0
+
+#if (ARDUINO >= 100)
+ #include <Arduino.h>
+#else
+ #include <WProgram.h>
+#endif
+#include <math.h>
+#include <RTL_Stdlib.h>
+#include "AF_MotionQueue.h"
+
+
+DEFINE_CLASSNAME(AF_MotionQueue);
+
+
+AF_MotionQueue::AF_MotionQueue(AF_MultiStepper& stepper) : _stepper(stepper)
+{
+    _first = 0;
+    _count = 0;
+    _busy = false;
+    _stopping = false;
+    _leadExit = 0;
+
+    for (uint8_t i=0; i < AF_MULTI_STEPPER_AXES; i++)  _end[i] = 0;
+}
+
+
+bool AF_MotionQueue::MoveTo(const int32_t* positions, uint32_t speed)
+{
+    if (IsFull()) return false;
+
+    if (_count == 0) SyncEnd();
+
+    int32_t togo[AF_MULTI_STEPPER_AXES];
+
+    for (uint8_t i=0; i < _stepper._count; i++)
+    {
+        int32_t unit = _stepper.Motion(i).Unit();
+
+        togo[i] = (positions[i] * _stepper.PositionUnits(i) - _end[i]) / unit;
+        _end[i] += togo[i] * unit;
+    }
+
+    Add(togo, speed);
+
+    return true;
+}
+
+
+bool AF_MotionQueue::Move(const int32_t* steps, uint32_t speed)
+{
+    if (IsFull()) return false;
+
+    if (_count == 0) SyncEnd();
+
+    int32_t positions[AF_MULTI_STEPPER_AXES];
+
+    for (uint8_t i=0; i < _stepper._count; i++)
+    {
+        positions[i] = _end[i] / _stepper.PositionUnits(i) + steps[i];
+    }
+
+    return MoveTo(positions, speed);
+}
+
+
+void AF_MotionQueue::Stop(void)
+{
+    _count = _busy ? 1 : 0;
+    _stopping = _busy;
+    _leadExit = 0;
+
+    _stepper.Stop();
+}
+
+
+bool AF_MotionQueue::Service(void)
+{
+    if (_busy && !_stepper.Service())
+    {
+        // The move is done. The next one goes on at the speed it left at.
+        Segment& done = Queued(0);
+        float speed = (_leadExit > 0) ? 1e6f / _stepper._motion.Interval() / done.scale : 0;
+
+        _first = (_first + 1) % AF_MOTION_QUEUE_SIZE;
+        _count--;
+        _busy = false;
+        _stopping = false;
+
+        if (_count > 0) StartNext(speed * speed);
+    }
+    else if (!_busy && _count > 0)
+    {
+        StartNext(0);
+    }
+
+    return _count > 0;
+}
+
+
+void AF_MotionQueue::SyncEnd(void)
+{
+    for (uint8_t i=0; i < _stepper._count; i++)  _end[i] = _stepper.Motion(i).Position();
+}
+
+
+void AF_MotionQueue::Add(const int32_t* togo, uint32_t speed)
+{
+    Segment& seg = Queued(_count);
+    uint32_t steps[AF_MULTI_STEPPER_AXES];
+    uint32_t leadSteps = 0;
+    float length2 = 0;
+
+    for (uint8_t i=0; i < _stepper._count; i++)
+    {
+        seg.togo[i] = togo[i];
+        steps[i] = (togo[i] < 0) ? -togo[i] : togo[i];
+        length2 += (float)togo[i] * togo[i];
+
+        if (steps[i] > leadSteps) leadSteps = steps[i];
+    }
+
+    if (leadSteps == 0) return;         // Already there
+
+    // The limits of the move are for its lead motor: scale them to the path
+    uint32_t minInterval;
+    uint32_t accel;
+    uint32_t jerk;
+
+    _stepper.Limits(steps, leadSteps, minInterval, accel, jerk);
+
+    seg.length = sqrt(length2);
+    seg.scale = leadSteps / seg.length;
+    seg.accel = accel / seg.scale;
+
+    float nominal = ((minInterval > 0) ? 1e6f / minInterval : 1e6f) / seg.scale;
+
+    if (speed > 0 && speed < nominal)
+    {
+        nominal = speed;
+        minInterval = 1e6f / (speed * seg.scale);
+    }
+
+    seg.minInterval = minInterval;
+    seg.nominal2 = nominal * nominal;
+    seg.maxEntry2 = 0;                  // From a standstill
+
+    if (_count > 0)
+    {
+        // The corner into the move is taken at the speed of a circle that
+        // touches both moves AF_MOTION_JUNCTION_DEVIATION from the corner, at
+        // the acceleration: v^2 = a * d * s / (1 - s), where s is the sine of
+        // half the angle between the moves (1 going straight on, 0 going
+        // back). It is never faster than either move.
+        Segment& prev = Queued(_count - 1);
+        float dot = 0;
+
+        for (uint8_t i=0; i < _stepper._count; i++)  dot += (float)prev.togo[i] * seg.togo[i];
+
+        float sine = sqrt((1 + dot / (prev.length * seg.length)) / 2);
+        float accel = (prev.accel < seg.accel) ? prev.accel : seg.accel;
+
+        seg.maxEntry2 = (prev.nominal2 < seg.nominal2) ? prev.nominal2 : seg.nominal2;
+
+        if (sine < 0.999f)
+        {
+            float corner2 = accel * AF_MOTION_JUNCTION_DEVIATION * sine / (1 - sine);
+
+            if (corner2 < seg.maxEntry2) seg.maxEntry2 = corner2;
+        }
+    }
+
+    seg.entry2 = seg.maxEntry2;
+    _count++;
+
+    Replan();
+
+    // The move under way may now go faster into the next
+    if (_busy) _stepper._motion.ExitSpeed(ExitSpeed());
+}
+
+
+void AF_MotionQueue::Replan(void)
+{
+    // Backwards from the last move, which ends at a standstill: each move is
+    // entered no faster than it can slow down from to the entry speed of the
+    // next. The entry speed of the move under way is what it was.
+    float exit2 = 0;
+
+    for (uint8_t n=_count; n-- > (_busy ? 1 : 0); )
+    {
+        Segment& seg = Queued(n);
+        float limit = exit2 + 2 * seg.accel * seg.length;
+
+        seg.entry2 = (seg.maxEntry2 < limit) ? seg.maxEntry2 : limit;
+        exit2 = seg.entry2;
+    }
+
+    // Forwards: and no faster than the move before can speed up to
+    for (uint8_t n=1; n < _count; n++)
+    {
+        Segment& prev = Queued(n - 1);
+        Segment& seg = Queued(n);
+        float limit = prev.entry2 + 2 * prev.accel * prev.length;
+
+        if (seg.entry2 > limit) seg.entry2 = limit;
+    }
+}
+
+
+void AF_MotionQueue::StartNext(float speed2)
+{
+    Segment& seg = Queued(0);
+
+    // Not faster than the last move actually left at
+    if (seg.entry2 > speed2) seg.entry2 = speed2;
+
+    _busy = true;
+
+    Replan();
+
+    _stepper.Blend(seg.togo, seg.minInterval, (uint32_t)(sqrt(seg.entry2) * seg.scale), ExitSpeed());
+}
+
+
+uint32_t AF_MotionQueue::ExitSpeed(void)
+{
+    _leadExit = (_count > 1) ? (uint32_t)(sqrt(Queued(1).entry2) * Queued(0).scale) : 0;
+
+    return _leadExit;
+}
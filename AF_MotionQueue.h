@@ -0,0 +1,194 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#ifndef _AF_MotionQueue_h_
+#define _AF_MotionQueue_h_
+
+#include <inttypes.h>
+#include <RTL_Stdlib.h>
+#include "AF_MultiStepper.h"
+
+
+// Number of moves the queue holds, including the one under way. Each takes
+// about 48 bytes of RAM; a longer queue lets the motors keep up more speed
+// through a path of short moves.
+#ifndef AF_MOTION_QUEUE_SIZE
+#define AF_MOTION_QUEUE_SIZE 8
+#endif
+
+// How far, in steps, the path may stray from a corner between two moves when
+// working out how fast the motors may take it. Larger values take corners
+// faster, and harder on the machine.
+#ifndef AF_MOTION_JUNCTION_DEVIATION
+#define AF_MOTION_JUNCTION_DEVIATION 1.0f
+#endif
+
+//******************************************************************************
+/// Queue of coordinated moves that are joined without stopping: the motors
+/// go straight on from one move into the next instead of slowing down to a
+/// standstill between them.
+///
+/// The moves are those of an AF_MultiStepper, with its motors, speeds and
+/// accelerations. Each time a move is queued, the speeds at the joins are
+/// planned again for the whole queue: a join is taken as fast as the corner
+/// between the two moves allows, and no faster than the motors can speed up
+/// to, or slow down from, over the moves on either side; the last move in the
+/// queue ends at a standstill. The queue is a fixed ring of
+/// AF_MOTION_QUEUE_SIZE moves, so it takes no memory beyond its own.
+///
+/// NOTE: Lengths and corners are worked out in steps of each motor, so the
+///       motors should move the machine about as far per step. The moves use
+///       trapezoidal ramps: the jerk of the motors is not used.
+//******************************************************************************
+class AF_MotionQueue
+{
+    DECLARE_CLASSNAME;
+
+    /*--------------------------------------------------------------------------
+    Constructors
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Constructor. The queue runs the moves of 'stepper', whose motors must
+    /// be added before the first move is queued.
+    //**************************************************************************
+    public: AF_MotionQueue(AF_MultiStepper& stepper);
+
+
+    /*--------------------------------------------------------------------------
+    Public methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Queues a move to absolute positions, or by numbers of steps relative to
+    /// where the moves queued before leave the motors, as with
+    /// AF_MultiStepper::MoveTo() and Move(). A speed other than 0 caps the
+    /// speed of the move along the path, in steps per second, below that of
+    /// the motors. Returns false, and queues nothing, if the queue is full or
+    /// stopping. The moves are started by Service().
+    //**************************************************************************
+    public: bool MoveTo(const int32_t* positions, uint32_t speed=0);
+    public: bool Move(const int32_t* steps, uint32_t speed=0);
+
+    //**************************************************************************
+    /// Drops the queued moves and stops the move under way as soon as
+    /// possible, at the latest at its end.
+    //**************************************************************************
+    public: void Stop(void);
+
+    //**************************************************************************
+    /// Issues the next steps if they are due, and starts the next move when one
+    /// ends. Call it from loop() as often as possible, instead of the
+    /// AF_MultiStepper's Service(). Returns true while there are moves to run.
+    //**************************************************************************
+    public: bool Service(void);
+
+
+    /*--------------------------------------------------------------------------
+    Public properties
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Gets the number of moves in the queue, including the one under way.
+    //**************************************************************************
+    public: uint8_t Count() { return _count; };
+
+    //**************************************************************************
+    /// Gets whether the queue is full: MoveTo() and Move() would fail.
+    //**************************************************************************
+    public: bool IsFull() { return _count == AF_MOTION_QUEUE_SIZE || _stopping; };
+
+    //**************************************************************************
+    /// Gets whether there are moves to run.
+    //**************************************************************************
+    public: bool IsRunning() { return _count > 0; };
+
+    //**************************************************************************
+    /// Gets the motors the queue moves.
+    //**************************************************************************
+    public: AF_MultiStepper& Stepper() { return _stepper; };
+
+
+    /*--------------------------------------------------------------------------
+    Internal methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Queues a move by numbers of steps, as in the motors' Unit(), and plans
+    /// the corner into it.
+    //**************************************************************************
+    private: void Add(const int32_t* togo, uint32_t speed);
+
+    //**************************************************************************
+    /// Starts the path where the motors are, when nothing is queued.
+    //**************************************************************************
+    private: void SyncEnd(void);
+
+    //**************************************************************************
+    /// Plans the entry speeds of the queued moves.
+    //**************************************************************************
+    private: void Replan(void);
+
+    //**************************************************************************
+    /// Starts the move at the head of the queue, entering it at most at the
+    /// speed along the path 'speed2' (squared) that the last move left at.
+    //**************************************************************************
+    private: void StartNext(float speed2);
+
+    //**************************************************************************
+    /// Gets the planned exit speed of the move under way, in steps of its
+    /// lead motor per second.
+    //**************************************************************************
+    private: uint32_t ExitSpeed(void);
+
+    private: struct Segment;
+
+    //**************************************************************************
+    /// Gets the n-th move of the queue, from the one under way.
+    //**************************************************************************
+    private: Segment& Queued(uint8_t n) { return _segs[(_first + n) % AF_MOTION_QUEUE_SIZE]; };
+
+
+    /*--------------------------------------------------------------------------
+    Internal state
+    --------------------------------------------------------------------------*/
+
+    // Speeds and accelerations are along the path, in steps per second (per
+    // second); speeds are kept squared, as the planning works in them.
+    private: struct Segment
+    {
+        int32_t  togo[AF_MULTI_STEPPER_AXES];   // Steps of each motor
+        uint32_t minInterval;                   // Step interval of the lead motor at the maximum speed
+        float    scale;                         // Steps of the lead motor per step along the path
+        float    length;                        // Length of the path in steps
+        float    accel;                         // Acceleration
+        float    nominal2;                      // Maximum speed
+        float    maxEntry2;                     // Highest entry speed the corner into the move allows
+        float    entry2;                        // Planned entry speed
+    };
+
+    private: AF_MultiStepper& _stepper;
+    private: Segment  _segs[AF_MOTION_QUEUE_SIZE];
+    private: uint8_t  _first;                   // Move under way, or next to start
+    private: uint8_t  _count;                   // Moves in the queue
+    private: bool     _busy;                    // The first move is under way
+    private: bool     _stopping;                // Stop() was called, and the motors have not stopped yet
+    private: uint32_t _leadExit;                // Exit speed the move under way was given, in its lead steps
+    private: int32_t  _end[AF_MULTI_STEPPER_AXES]; // Where the queued moves leave the motors, in position units
+};
+
+#endif
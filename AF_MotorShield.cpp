@@ -22,37 +22,40 @@ Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
 #else
  #include <WProgram.h>
 #endif
-#include <Wire.h>
 #include <RTL_Stdlib.h>
 #include "AF_MotorShield.h"
 
 
-#if defined(ARDUINO_SAM_DUE)
- #define WIRE Wire1
-#else
- #define WIRE Wire
-#endif
+DEFINE_CLASSNAME(AF_MotorShield);
 
 
-DEFINE_CLASSNAME(AF_MotorShield);
+void (*AF_MotorShield::_engineStop)(void) = NULL;
 
 
-AF_MotorShield::AF_MotorShield(uint8_t addr) 
+AF_MotorShield::AF_MotorShield(uint8_t addr, AF_MS_Bus& bus) 
 {
     _addr = addr;
-    _pwm = AF_MS_PWMServoDriver(_addr);
+    _freq = 0;
+    _frameCommit = true;
+    _updateDepth = 0;
+    _stopLatency = 0;
+    _pwm = AF_MS_PWMServoDriver(_addr, bus);
 }
 
 
-void AF_MotorShield::Begin(uint16_t freq) 
+void AF_MotorShield::Begin(uint16_t freq, uint32_t i2cClock) 
 {
     // initialize PWM w/_freq
-    WIRE.begin();
-    _pwm.begin();
-    _freq = freq;
-    _pwm.setPWMFreq(_freq);  // This is the maximum PWM frequency
-
-    for (uint8_t i=0; i < 16; i++)  _pwm.setPWM(i, 0, 0);
+    _pwm.begin(i2cClock);
+    _freq = _pwm.setPWMFreq(freq);  // Frequency actually achieved
+    ApplyFrameCommit();
+
+    // After a warm start (MCU reset while the board kept running) keep the
+    // outputs as they are and just pick up their state from the board.
+    if (_pwm.isWarmStart())
+        _pwm.resync();
+    else
+        AllOff();
 
     // Initialize DC motors
     _dcMotors[0].Initialize(this, 0,  8, 10,  9);
@@ -66,21 +69,149 @@ void AF_MotorShield::Begin(uint16_t freq)
 }
 
 
+void AF_MotorShield::FrameCommit(bool enable) 
+{
+    _frameCommit = enable;
+
+    if (_freq != 0) ApplyFrameCommit();     // Otherwise Begin() will do it
+}
+
+
+void AF_MotorShield::ApplyFrameCommit(void) 
+{
+    _pwm.setMode2(PCA9685_MODE2_OUTDRV | (_frameCommit ? 0 : PCA9685_MODE2_OCH));
+}
+
+
+void AF_MotorShield::BeginUpdate(void) 
+{
+    _updateDepth++;
+}
+
+
+bool AF_MotorShield::Commit(void) 
+{
+    if (_updateDepth > 0) _updateDepth--;
+
+    return (_updateDepth == 0) ? _pwm.flush() : true;
+}
+
+
+bool AF_MotorShield::AllOff(void) 
+{
+    bool ok = _pwm.setAllPWM(0, 4096);  // Full-off bit overrides any ON/OFF counts
+
+    OutputsOff(false);
+
+    return ok;
+}
+
+
+bool AF_MotorShield::EmergencyStop(void) 
+{
+    uint32_t start = micros();
+
+    // The engine would go on queuing steps of its motors
+    StopEngine();
+
+    // On an asynchronous bus, coil writes still queued would turn the motors
+    // back on after the stop: drop them, and wait for the stop to be sent
+    _pwm.discardQueued();
+
+    bool ok = _pwm.setAllPWM(0, 4096);
+
+    OutputsOff(true);
+    _pwm.waitForBus();
+    _stopLatency = micros() - start;
+
+    return ok;
+}
+
+
+void AF_MotorShield::OutputsOff(bool emergency) 
+{
+    // Keep the DC motor state in line with the outputs
+    for (uint8_t i=0; i < 4; i++)
+    {
+        _dcMotors[i]._motorState.mode = AF_DCMotor::RELEASE;
+        _dcMotors[i]._motorState.speed = 0;
+    }
+
+    if (!emergency) return;
+
+    _updateDepth = 0;
+
+    // Stop the steppers where they stand, so Run() or Service() do not take
+    // them on to their targets
+    for (uint8_t i=0; i < 2; i++)
+    {
+        AF_StepperMotion& motion = _stepperMotors[i]._motion;
+
+        motion.Position(motion.Position());
+    }
+}
+
+
+void AF_MotorShield::StopEngine(void) 
+{
+    if (_engineStop != NULL) _engineStop();
+}
+
+
 void AF_MotorShield::SetPWM(uint8_t pin, uint16_t value) 
 {
     if (value > 4095) 
-        _pwm.setPWM(pin, 4096, 0);
+        WritePWM(pin, 4096, 0);
+    else if (value == 0)
+        WritePWM(pin, 0, 4096);
     else 
-        _pwm.setPWM(pin, 0, value);
+        WritePWM(pin, 0, value);
 }
 
 
 void AF_MotorShield::SetPin(uint8_t pin, boolean value) 
 {
     if (value == LOW)
-        _pwm.setPWM(pin, 0, 0);
+        WritePWM(pin, 0, 4096);
+    else
+        WritePWM(pin, 4096, 0);
+}
+
+
+void AF_MotorShield::WritePWM(uint8_t pin, uint16_t on, uint16_t off) 
+{
+    if (_updateDepth > 0)
+        _pwm.stagePWM(pin, on, off);
+    else
+        _pwm.setPWM(pin, on, off);
+}
+
+
+void AF_MotorShield::SetPWMBlock(uint8_t firstPin, uint8_t count, const uint16_t* values) 
+{
+    uint16_t on[16];
+    uint16_t off[16];
+
+    if (firstPin >= 16 || count > 16 - firstPin) return;   // The board only has 16 channels
+
+    for (uint8_t i=0; i < count; i++)
+    {
+        on[i]  = (values[i] > 4095) ? 4096 : 0;
+        off[i] = (values[i] > 4095) ? 0 : (values[i] == 0) ? 4096 : values[i];
+    }
+
+    if (_updateDepth > 0 && _frameCommit)
+    {
+        _pwm.stageFrame(firstPin, count, on, off);
+    }
+    else if (_updateDepth > 0)
+    {
+        for (uint8_t i=0; i < count; i++)  _pwm.stagePWM(firstPin + i, on[i], off[i]);
+    }
     else
-        _pwm.setPWM(pin, 4096, 0);
+    {
+        _pwm.setPWMBlock(firstPin, count, on, off);
+    }
 }
 
 
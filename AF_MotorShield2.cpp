@@ -18,18 +18,10 @@ Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
 #define DEBUG 0
 
 #include <Arduino.h>
-#include <Wire.h>
 #include <RTL_Stdlib.h>
 #include "AF_MotorShield2.h"
 
 
-#if defined(ARDUINO_SAM_DUE)
- #define WIRE Wire1
-#else
- #define WIRE Wire
-#endif
-
-
 // Motor port configurations for DC and stepper motors
 static const uint8_t DCMOTOR_0 = 0b00000001;    // DC motor 0 uses port 0
 static const uint8_t DCMOTOR_1 = 0b00000010;    // DC motor 1 uses port 1
@@ -41,22 +33,30 @@ static const uint8_t STEPPER_1 = 0b00001100;    // Stepper motor 1 uses ports 2
 DEFINE_CLASSNAME(AF_MotorShield2);
 
 
-AF_MotorShield2::AF_MotorShield2(uint8_t addr) 
+AF_MotorShield2::AF_MotorShield2(uint8_t addr, AF_MS_Bus& bus) 
 {
     _addr = addr;
-    _pwm = AF_MS_PWMServoDriver(_addr);
+    _freq = 0;
+    _frameCommit = true;
+    _updateDepth = 0;
+    _stopLatency = 0;
+    _pwm = AF_MS_PWMServoDriver(_addr, bus);
 }
 
 
-void AF_MotorShield2::Begin(uint16_t freq) 
+void AF_MotorShield2::Begin(uint16_t freq, uint32_t i2cClock) 
 {
     // initialize PWM w/_freq
-    WIRE.begin();
-    _pwm.begin();
-    _freq = freq;
-    _pwm.setPWMFreq(_freq);  // This is the maximum PWM frequency
-
-    for (uint8_t i=0; i < 16; i++)  _pwm.setPWM(i, 0, 0);
+    _pwm.begin(i2cClock);
+    _freq = _pwm.setPWMFreq(freq);  // Frequency actually achieved
+    ApplyFrameCommit();
+
+    // After a warm start (MCU reset while the board kept running) keep the
+    // outputs as they are and just pick up their state from the board.
+    if (_pwm.isWarmStart())
+        _pwm.resync();
+    else
+        AllOff();
 
     // // Initialize DC motors
     // _dcMotors[0].Initialize(this, 0,  8, 10,  9);
@@ -114,20 +114,118 @@ void AF_MotorShield2::Detach(AF_DCMotor2& motor)
 }
 
 
+void AF_MotorShield2::SetFrameCommit(bool enable) 
+{
+    _frameCommit = enable;
+
+    if (_freq != 0) ApplyFrameCommit();     // Otherwise Begin() will do it
+}
+
+
+void AF_MotorShield2::ApplyFrameCommit(void) 
+{
+    _pwm.setMode2(PCA9685_MODE2_OUTDRV | (_frameCommit ? 0 : PCA9685_MODE2_OCH));
+}
+
+
+void AF_MotorShield2::BeginUpdate(void) 
+{
+    _updateDepth++;
+}
+
+
+bool AF_MotorShield2::Commit(void) 
+{
+    if (_updateDepth > 0) _updateDepth--;
+
+    return (_updateDepth == 0) ? _pwm.flush() : true;
+}
+
+
+bool AF_MotorShield2::AllOff(void) 
+{
+    return _pwm.setAllPWM(0, 4096);     // Full-off bit overrides any ON/OFF counts
+}
+
+
+bool AF_MotorShield2::EmergencyStop(void) 
+{
+    _updateDepth = 0;
+
+    uint32_t start = micros();
+
+    // On an asynchronous bus, coil writes still queued would turn the motors
+    // back on after the stop: drop them, and wait for the stop to be sent
+    _pwm.discardQueued();
+
+    bool ok = AllOff();
+
+    _pwm.waitForBus();
+    _stopLatency = micros() - start;
+
+    return ok;
+}
+
+
+void AF_MotorShield2::OutputsOff(bool emergency) 
+{
+    if (emergency) _updateDepth = 0;
+}
+
+
 void AF_MotorShield2::SetPWM(uint8_t pin, uint16_t value) 
 {
     if (value > 4095) 
-        _pwm.setPWM(pin, 4096, 0);
+        WritePWM(pin, 4096, 0);
+    else if (value == 0)
+        WritePWM(pin, 0, 4096);
     else 
-        _pwm.setPWM(pin, 0, value);
+        WritePWM(pin, 0, value);
 }
 
 
 void AF_MotorShield2::SetPin(uint8_t pin, boolean value) 
 {
     if (value == LOW)
-        _pwm.setPWM(pin, 0, 0);
+        WritePWM(pin, 0, 4096);
+    else
+        WritePWM(pin, 4096, 0);
+}
+
+
+void AF_MotorShield2::WritePWM(uint8_t pin, uint16_t on, uint16_t off) 
+{
+    if (_updateDepth > 0)
+        _pwm.stagePWM(pin, on, off);
+    else
+        _pwm.setPWM(pin, on, off);
+}
+
+
+void AF_MotorShield2::SetPWMBlock(uint8_t firstPin, uint8_t count, const uint16_t* values) 
+{
+    uint16_t on[16];
+    uint16_t off[16];
+
+    if (firstPin >= 16 || count > 16 - firstPin) return;   // The board only has 16 channels
+
+    for (uint8_t i=0; i < count; i++)
+    {
+        on[i]  = (values[i] > 4095) ? 4096 : 0;
+        off[i] = (values[i] > 4095) ? 0 : (values[i] == 0) ? 4096 : values[i];
+    }
+
+    if (_updateDepth > 0 && _frameCommit)
+    {
+        _pwm.stageFrame(firstPin, count, on, off);
+    }
+    else if (_updateDepth > 0)
+    {
+        for (uint8_t i=0; i < count; i++)  _pwm.stagePWM(firstPin + i, on[i], off[i]);
+    }
     else
-        _pwm.setPWM(pin, 4096, 0);
+    {
+        _pwm.setPWMBlock(firstPin, count, on, off);
+    }
 }
 
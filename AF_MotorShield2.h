@@ -15,8 +15,8 @@ Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
 
  This adaptation was written by R. Terry Lessly 2016-11-07.
  ******************************************************************/
-#ifndef _AF_MotorShield_h_
-#define _AF_MotorShield_h_
+#ifndef _AF_MotorShield2_h_
+#define _AF_MotorShield2_h_
 
 #include <inttypes.h>
 #include <RTL_Stdlib.h>
@@ -32,6 +32,7 @@ class AF_MotorShield2
     // Declare the motor classes as friends so they can access the SetPin() and SetPWM() methods
     friend class AF_DCMotor2;
     friend class AF_StepperMotor2;
+    friend class AF_MotorShieldGroup;
 
     /*--------------------------------------------------------------------------
     Constructors
@@ -44,8 +45,11 @@ class AF_MotorShield2
     /// address. If the board address has been altered (by soldering a bridge across
     /// any combination of the address jumper pads on the board) then this parameter
     /// must match the new address of the board.
+    /// The bus parameter selects the I2C bus the board is connected to, e.g.
+    /// AF_MS_Wire or AF_MS_Wire1 on boards with two TWI peripherals. Shields on
+    /// different buses can use the same address.
     //**************************************************************************
-    public: AF_MotorShield2(uint8_t addr = 0x60);
+    public: AF_MotorShield2(uint8_t addr = 0x60, AF_MS_Bus& bus = AF_MS_DEFAULT_BUS);
 
     
     /*--------------------------------------------------------------------------
@@ -56,8 +60,40 @@ class AF_MotorShield2
     /// Initializes the MotorShield.
     /// The freq parameter sets the PWM frequency for the board. If not specified,
     /// it defaults to 1600 Hz.
+    /// The i2cClock parameter sets the I2C bus clock in Hz: 100000 (Standard-mode,
+    /// the default), 400000 (Fast-mode) or 1000000 (Fast-mode Plus). Faster bus
+    /// clocks directly raise the maximum stepper step rate. The clock applies to
+    /// the whole bus, so shields on the same bus should all use the same value.
+    ///
+    /// If the board is found already running with the requested frequency
+    /// (e.g. the Arduino was reset by a watchdog but the board kept power),
+    /// Begin() skips the oscillator restart and leaves all outputs as they
+    /// are, so running motors do not drop out. Otherwise all outputs are
+    /// turned off. WarmStart() tells which case happened.
     //**************************************************************************
-    public: void Begin(uint16_t freq = 1600);
+    public: void Begin(uint16_t freq = 1600, uint32_t i2cClock = 100000);
+
+    //**************************************************************************
+    /// Indicates whether the last Begin() found the board already configured
+    /// and left its outputs running.
+    //**************************************************************************
+    public: bool WarmStart() { return _pwm.isWarmStart(); };
+
+    //**************************************************************************
+    /// Gets the I2C bus clock, in Hz, actually applied by Begin().
+    //**************************************************************************
+    public: uint32_t I2CClock() { return _pwm.getI2CClock(); };
+
+    //**************************************************************************
+    /// Gets the I2C bus the board is connected to.
+    //**************************************************************************
+    public: AF_MS_Bus& Bus() { return _pwm.getBus(); };
+
+    //**************************************************************************
+    /// Gets the PWM frequency, in Hz, actually achieved by Begin(). It is the
+    /// achievable frequency nearest to the one requested.
+    //**************************************************************************
+    public: uint16_t PWMFreq() { return _freq; };
 
     //**************************************************************************
     /// Attaches a DC motor to the MotorShield.
@@ -74,6 +110,84 @@ class AF_MotorShield2
     //**************************************************************************
     //public: bool Attach(AF_StepperMotor2& motor, uint8_t motorNum, uint16_t steps);
 
+    //**************************************************************************
+    /// Gets or sets the frame-commit mode (on by default). In this mode the
+    /// board changes its outputs on the I2C STOP condition, and the six coil
+    /// channels of a stepper step are always written in one transaction, even
+    /// inside a deferred update, so the H-bridges never see a half-applied
+    /// step. With it off, each channel changes as soon as its registers are
+    /// acknowledged, which lowers the latency of single-pin writes.
+    //**************************************************************************
+    public: bool GetFrameCommit() { return _frameCommit; };
+    public: void SetFrameCommit(bool enable);
+
+    //**************************************************************************
+    /// Gets the bus health counters of this board: transactions, bytes, NACKs,
+    /// timeouts, other errors, retries, failed transactions and bus
+    /// recoveries (see AF_MS_BusStats). Reading them costs nothing, so they
+    /// can be sampled every loop to correlate lost steps with bus errors.
+    //**************************************************************************
+    public: const AF_MS_BusStats& GetBusStats() { return _pwm.getStats(); };
+    public: void ResetBusStats() { _pwm.resetStats(); };
+
+    //**************************************************************************
+    /// Gets the status of the last transaction with the board: AF_MS_BUS_OK, or
+    /// one of the AF_MS_BUS_* error codes.
+    //**************************************************************************
+    public: uint8_t GetLastBusError() { return _pwm.getLastError(); };
+
+    //**************************************************************************
+    /// Sets how many times a failed transaction is repeated before it is given
+    /// up (2 by default). Bus errors and timeouts run the bus recovery
+    /// sequence before each new attempt.
+    //**************************************************************************
+    public: uint8_t GetRetryLimit() { return _pwm.getRetryLimit(); };
+    public: void SetRetryLimit(uint8_t retries) { _pwm.setRetryLimit(retries); };
+
+    //**************************************************************************
+    /// Frees a bus held low by a slave, by clocking SCL until SDA is released
+    /// and sending a STOP. Returns true if the bus is free afterwards.
+    //**************************************************************************
+    public: bool RecoverBus() { return _pwm.recoverBus(); };
+
+    //**************************************************************************
+    /// Starts a deferred update. Until the matching Commit() call, motor methods
+    /// only mark the affected PWM channels dirty instead of writing them to the
+    /// board. Calls may be nested; only the outermost Commit() writes.
+    //**************************************************************************
+    public: void BeginUpdate(void);
+
+    //**************************************************************************
+    /// Ends a deferred update started with BeginUpdate() and writes all dirty
+    /// channels to the board in as few burst transactions as possible. Since
+    /// the board latches its outputs on the I2C STOP condition, all channels
+    /// written in one transaction change together. Returns false if a write
+    /// failed after its retries.
+    //**************************************************************************
+    public: bool Commit(void);
+
+    //**************************************************************************
+    /// Turns off all 16 outputs of the board in a single transaction using the
+    /// ALL_LED registers. Motors must be commanded again afterwards. Returns
+    /// false if the write failed after its retries.
+    //**************************************************************************
+    public: bool AllOff(void);
+
+    //**************************************************************************
+    /// Same as AllOff(), but also abandons any deferred update in progress so
+    /// that a later Commit() cannot re-energize a motor. On an asynchronous
+    /// bus, writes still queued are dropped and the stop is waited for until
+    /// it is on the wire. The time taken to turn the outputs off is measured
+    /// and can be read with StopLatency().
+    //**************************************************************************
+    public: bool EmergencyStop(void);
+
+    //**************************************************************************
+    /// Gets the time, in microseconds, the last EmergencyStop() took to turn
+    /// off all outputs, until the bus was idle.
+    //**************************************************************************
+    public: uint16_t StopLatency() { return _stopLatency; };
+
     
     /*--------------------------------------------------------------------------
     Internal methods
@@ -89,6 +203,30 @@ class AF_MotorShield2
     //**************************************************************************
     private: void SetPin(uint8_t pin, boolean value);
 
+    //**************************************************************************
+    /// Internal method to set a run of consecutive pins in one burst transaction.
+    /// The values use the same encoding as SetPWM(), so a digital HIGH is 4096.
+    /// A run that goes past pin 15 is ignored.
+    //**************************************************************************
+    private: void SetPWMBlock(uint8_t firstPin, uint8_t count, const uint16_t* values);
+
+    //**************************************************************************
+    /// Internal method to bring the shield's state in line with its outputs
+    /// after they were turned off through ALL_LED, by AllOff() or by a group.
+    /// An emergency stop also abandons any deferred update.
+    //**************************************************************************
+    private: void OutputsOff(bool emergency);
+
+    //**************************************************************************
+    /// Internal method to program MODE2 for the frame-commit mode.
+    //**************************************************************************
+    private: void ApplyFrameCommit(void);
+
+    //**************************************************************************
+    /// Internal method to write (or stage, during a deferred update) one channel.
+    //**************************************************************************
+    private: void WritePWM(uint8_t pin, uint16_t on, uint16_t off);
+
     
     /*--------------------------------------------------------------------------
     Internal state
@@ -96,6 +234,9 @@ class AF_MotorShield2
     private: uint8_t  _addr;            // I2C address
     private: uint8_t  _ports;           // Allocation bits for 4 motor ports (uses 4 LS bits)
     private: uint16_t _freq;            // PWM frequency
+    private: bool     _frameCommit;
+    private: uint8_t  _updateDepth;     // Nesting depth of BeginUpdate()/Commit()
+    private: uint16_t _stopLatency;     // Duration of the last EmergencyStop() in microseconds
     private: AF_MS_PWMServoDriver _pwm; // Helper class for PWM
 };
 
@@ -0,0 +1,215 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#define DEBUG 0
+
+#if (ARDUINO >= 100)
+ #include <Arduino.h>
+#else
+ #include <WProgram.h>
+#endif
+#include <RTL_Stdlib.h>
+#include "AF_MotorShield.h"
+#include "AF_MotorShield2.h"
+#include "AF_MotorShieldGroup.h"
+
+
+DEFINE_CLASSNAME(AF_MotorShieldGroup);
+
+
+AF_MotorShieldGroup::AF_MotorShieldGroup(uint8_t groupAddr, uint8_t subAddr, AF_MS_Bus& bus)
+{
+    _addr = groupAddr;
+    _subAddr = subAddr;
+    _count = 0;
+    _updateDepth = 0;
+    _stopLatency = 0;
+    _pwm = AF_MS_PWMServoDriver(_addr, bus);
+}
+
+
+bool AF_MotorShieldGroup::Add(AF_MotorShield& shield)
+{
+    if (!AddDriver(&shield._pwm, shield._addr)) return false;
+
+    _shields[_count - 1] = &shield;
+
+    return true;
+}
+
+
+bool AF_MotorShieldGroup::Add(AF_MotorShield2& shield)
+{
+    if (!AddDriver(&shield._pwm, shield._addr)) return false;
+
+    _shields2[_count - 1] = &shield;
+
+    return true;
+}
+
+
+bool AF_MotorShieldGroup::AddDriver(AF_MS_PWMServoDriver* pwm, uint8_t addr)
+{
+    if (_count >= AF_MS_GROUP_SIZE) return false;   // Group is full
+    if (addr == _addr) return false;                // Board would answer twice to the group address
+    if (&pwm->getBus() != &_pwm.getBus()) return false;     // Group writes would never reach it
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (_members[i] == pwm) return false;       // Already a member
+    }
+
+    _members[_count] = pwm;
+    _shields[_count] = NULL;
+    _shields2[_count] = NULL;
+    _count++;
+
+    return true;
+}
+
+
+void AF_MotorShieldGroup::Begin(void)
+{
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (_subAddr == 0)
+            _members[i]->setAllCallAddress(_addr);
+        else
+            _members[i]->setSubAddress(_subAddr, _addr);
+    }
+
+    // Nothing is ever read through the group address, so its shadow is never
+    // considered in sync with the boards; every staged pin is written.
+    _pwm.invalidate();
+}
+
+
+void AF_MotorShieldGroup::BeginUpdate(void)
+{
+    _updateDepth++;
+}
+
+
+bool AF_MotorShieldGroup::Commit(void)
+{
+    if (_updateDepth > 0) _updateDepth--;
+
+    return (_updateDepth == 0) ? Flush() : true;
+}
+
+
+void AF_MotorShieldGroup::SetPWM(uint8_t pin, uint16_t value)
+{
+    if (value > 4095)
+        WritePWM(pin, 4096, 0);
+    else if (value == 0)
+        WritePWM(pin, 0, 4096);
+    else
+        WritePWM(pin, 0, value);
+}
+
+
+void AF_MotorShieldGroup::SetPin(uint8_t pin, boolean value)
+{
+    if (value == LOW)
+        WritePWM(pin, 0, 4096);
+    else
+        WritePWM(pin, 4096, 0);
+}
+
+
+bool AF_MotorShieldGroup::AllOff(void)
+{
+    return TurnOff(false);
+}
+
+
+bool AF_MotorShieldGroup::EmergencyStop(void)
+{
+    _updateDepth = 0;
+
+    uint32_t start = micros();
+
+    AF_MotorShield::StopEngine();
+
+    // The members share the group's bus: writes still queued on it are dropped
+    _pwm.discardQueued();
+
+    bool ok = TurnOff(true);
+
+    _pwm.waitForBus();
+    _stopLatency = micros() - start;
+
+    return ok;
+}
+
+
+bool AF_MotorShieldGroup::TurnOff(bool emergency)
+{
+    bool ok = _pwm.setAllPWM(0, 4096);
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        // If the write failed, no member can be trusted to hold the values
+        _members[i]->discardStaged();
+
+        if (ok)
+            _members[i]->assumeWritten(_pwm, 0xFFFF);
+        else
+            _members[i]->invalidate();
+
+        // Reset the members as their own AllOff() would
+        if (_shields[i] != NULL) _shields[i]->OutputsOff(emergency);
+        if (_shields2[i] != NULL) _shields2[i]->OutputsOff(emergency);
+    }
+
+    _pwm.invalidate();
+
+    return ok;
+}
+
+
+void AF_MotorShieldGroup::WritePWM(uint8_t pin, uint16_t on, uint16_t off)
+{
+    _pwm.stagePWM(pin, on, off);
+
+    if (_updateDepth == 0) Flush();
+}
+
+
+bool AF_MotorShieldGroup::Flush(void)
+{
+    uint16_t written = _pwm.dirtyMask();
+
+    if (written == 0) return true;
+
+    bool ok = _pwm.flush();
+
+    // Every member received the same data, so bring their shadows up to date.
+    // After a failed write, which members took it is unknown.
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (ok)
+            _members[i]->assumeWritten(_pwm, written);
+        else
+            _members[i]->invalidate();
+    }
+
+    _pwm.invalidate();
+
+    return ok;
+}
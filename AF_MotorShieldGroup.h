@@ -0,0 +1,137 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#ifndef _AF_MotorShieldGroup_h_
+#define _AF_MotorShieldGroup_h_
+
+#include <inttypes.h>
+#include <RTL_Stdlib.h>
+#include "utility/AF_MS_PWMServoDriver.h"
+
+
+class AF_MotorShield;
+class AF_MotorShield2;
+
+
+#define AF_MS_GROUP_SIZE 8   // Maximum number of shields in a group
+
+class AF_MotorShieldGroup
+{
+    DECLARE_CLASSNAME;
+
+    /*--------------------------------------------------------------------------
+    Constructors
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Constructor.
+    /// The groupAddr parameter is the I2C address every member shield will also
+    /// answer to. It must not be the address of any board on the bus. The
+    /// subAddr parameter selects which PCA9685 group address is programmed:
+    /// 0 uses the ALLCALL address, 1 to 3 use SUBADR1 to SUBADR3. The defaults
+    /// match the power-on ALLCALL address of the PCA9685 (0x70). The bus
+    /// parameter is the I2C bus of the member shields; a group cannot span
+    /// buses.
+    //**************************************************************************
+    public: AF_MotorShieldGroup(uint8_t groupAddr = 0x70, uint8_t subAddr = 0, AF_MS_Bus& bus = AF_MS_DEFAULT_BUS);
+
+
+    /*--------------------------------------------------------------------------
+    Public methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Adds a shield to the group. Returns false if the group is full, if the
+    /// shield's address is the group address, or if the shield is on another bus.
+    //**************************************************************************
+    public: bool Add(AF_MotorShield& shield);
+    public: bool Add(AF_MotorShield2& shield);
+
+    //**************************************************************************
+    /// Programs the group address on every member shield. Call this after the
+    /// Begin() method of every member shield, because that resets MODE1.
+    //**************************************************************************
+    public: void Begin(void);
+
+    //**************************************************************************
+    /// Starts a deferred group update. Pins set until the matching Commit() are
+    /// written to all member shields in the same burst transactions, so every
+    /// board changes its outputs on the same I2C STOP condition. Commit()
+    /// returns false if a write failed after its retries.
+    //**************************************************************************
+    public: void BeginUpdate(void);
+    public: bool Commit(void);
+
+    //**************************************************************************
+    /// Sets a PWM or digital pin to the same value on every member shield.
+    //**************************************************************************
+    public: void SetPWM(uint8_t pin, uint16_t value);
+    public: void SetPin(uint8_t pin, boolean value);
+
+    //**************************************************************************
+    /// Turns off all outputs of every member shield in one 6-byte transaction,
+    /// and resets the members as their own AllOff() does. EmergencyStop() also
+    /// discards any deferred updates, on the group and on the members, halts
+    /// the steppers as the members' EmergencyStop() does, drops the writes
+    /// still queued on an asynchronous bus, and measures the time taken (see
+    /// StopLatency()). Both return false if the write failed after its
+    /// retries.
+    //**************************************************************************
+    public: bool AllOff(void);
+    public: bool EmergencyStop(void);
+
+
+    /*--------------------------------------------------------------------------
+    Public properties
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Gets the number of shields in the group.
+    //**************************************************************************
+    public: uint8_t Count() { return _count; };
+
+    //**************************************************************************
+    /// Gets the time, in microseconds, the last EmergencyStop() took.
+    //**************************************************************************
+    public: uint16_t StopLatency() { return _stopLatency; };
+
+
+    /*--------------------------------------------------------------------------
+    Internal methods
+    --------------------------------------------------------------------------*/
+
+    private: bool AddDriver(AF_MS_PWMServoDriver* pwm, uint8_t addr);
+    private: void WritePWM(uint8_t pin, uint16_t on, uint16_t off);
+    private: bool Flush(void);
+    private: bool TurnOff(bool emergency);
+
+
+    /*--------------------------------------------------------------------------
+    Internal state
+    --------------------------------------------------------------------------*/
+    private: uint8_t  _addr;            // Group I2C address
+    private: uint8_t  _subAddr;         // 0 = ALLCALL, 1-3 = SUBADRn
+    private: uint8_t  _count;           // Number of member shields
+    private: uint8_t  _updateDepth;     // Nesting depth of BeginUpdate()/Commit()
+    private: uint16_t _stopLatency;     // Duration of the last EmergencyStop() in microseconds
+    private: AF_MS_PWMServoDriver  _pwm;                         // Driver for the group address
+    private: AF_MS_PWMServoDriver* _members[AF_MS_GROUP_SIZE];   // Drivers of the member shields
+    private: AF_MotorShield*  _shields[AF_MS_GROUP_SIZE];        // Member shields, NULL for an AF_MotorShield2
+    private: AF_MotorShield2* _shields2[AF_MS_GROUP_SIZE];       // Member shields, NULL for an AF_MotorShield
+};
+
+#endif
@@ -0,0 +1,319 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#define DEBUG 0
+
+#if (ARDUINO >= 100)
+ #include <Arduino.h>
+#else
+ #include <WProgram.h>
+#endif
+#include <RTL_Stdlib.h>
+#include "AF_MotorShield.h"
+#include "AF_MotorShield2.h"
+#include "AF_StepperMotor2.h"
+#include "AF_MultiStepper.h"
+
+
+DEFINE_CLASSNAME(AF_MultiStepper);
+
+
+AF_MultiStepper::AF_MultiStepper(void)
+{
+    _count = 0;
+    _running = false;
+    _leadSteps = 0;
+}
+
+
+bool AF_MultiStepper::Add(AF_StepperMotor* motor)
+{
+    if (_count >= AF_MULTI_STEPPER_AXES) return false;     // Move is full
+    if (motor == NULL || motor->_controller == NULL) return false;
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (_axes[i].motor == motor) return false;      // Already in the move
+    }
+
+    _axes[_count].motor = motor;
+    _axes[_count].motor2 = NULL;
+    _axes[_count].dir = 1;
+    _axes[_count].steps = 0;
+    _axes[_count].error = 0;
+    _count++;
+
+    return true;
+}
+
+
+bool AF_MultiStepper::Add(AF_StepperMotor2& motor)
+{
+    if (_count >= AF_MULTI_STEPPER_AXES) return false;     // Move is full
+    if (motor._controller == NULL) return false;            // Not attached to a shield
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (_axes[i].motor2 == &motor) return false;    // Already in the move
+    }
+
+    _axes[_count].motor = NULL;
+    _axes[_count].motor2 = &motor;
+    _axes[_count].dir = 1;
+    _axes[_count].steps = 0;
+    _axes[_count].error = 0;
+    _count++;
+
+    return true;
+}
+
+
+void AF_MultiStepper::MoveTo(const int32_t* positions)
+{
+    int32_t togo[AF_MULTI_STEPPER_AXES];
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        AF_StepperMotion& motion = Motion(i);
+
+        togo[i] = (positions[i] * PositionUnits(i) - motion.Position()) / (int32_t)motion.Unit();
+    }
+
+    Prepare(togo);
+    UpdateProfile();
+
+    _motion.Position(0);
+    _motion.MoveTo(_leadSteps);
+    _running = _leadSteps > 0;
+}
+
+
+void AF_MultiStepper::Move(const int32_t* steps)
+{
+    int32_t positions[AF_MULTI_STEPPER_AXES];
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        AF_StepperMotion& motion = Motion(i);
+
+        positions[i] = motion.Position() / PositionUnits(i) + steps[i];
+    }
+
+    MoveTo(positions);
+}
+
+
+void AF_MultiStepper::Stop(void)
+{
+    _motion.Stop();
+}
+
+
+bool AF_MultiStepper::Service(void)
+{
+    if (!_running) return false;
+
+    if (_motion.Due(micros()) != 0) Step();
+
+    if (!_motion.IsMoving())
+    {
+        // Done, or stopped short: the motors stay where they are
+        for (uint8_t i=0; i < _count; i++)
+        {
+            AF_StepperMotion& motion = Motion(i);
+
+            motion.Position(motion.Position());
+        }
+
+        _running = false;
+    }
+
+    return _running;
+}
+
+
+void AF_MultiStepper::Blend(const int32_t* togo, uint32_t minInterval, uint32_t entrySpeed, uint32_t exitSpeed)
+{
+    Prepare(togo);
+    UpdateProfile();
+
+    // Joined moves use trapezoidal ramps
+    _motion.SetProfile(1, minInterval, _motion.Accel(), 0);
+    _motion.Position(0);
+    _motion.Blend(_leadSteps, entrySpeed, exitSpeed);
+    _running = _leadSteps > 0;
+}
+
+
+void AF_MultiStepper::Prepare(const int32_t* togo)
+{
+    _leadSteps = 0;
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        Axis& axis = _axes[i];
+        AF_StepperMotion& motion = Motion(i);
+
+        axis.dir = (togo[i] < 0) ? -1 : 1;
+        axis.steps = (togo[i] < 0) ? -togo[i] : togo[i];
+
+        // The motor's own target is where the move leaves it, so that its
+        // DistanceToGo() counts down with the move; any move of its own is
+        // dropped.
+        motion.Position(motion.Position());
+        motion.MoveTo(motion.Position() + togo[i] * (int32_t)motion.Unit());
+
+        if (axis.steps > _leadSteps) _leadSteps = axis.steps;
+    }
+
+    // Start every accumulator half way, so the steps of the other motors fall
+    // in the middle of their share of the lead motor's steps
+    for (uint8_t i=0; i < _count; i++)  _axes[i].error = _leadSteps / 2;
+}
+
+
+void AF_MultiStepper::Hold(void)
+{
+    // A step of 0 writes the coil currents of the current step
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (_axes[i].motor != NULL)
+            _axes[i].motor->OneStep(0);
+        else
+            _axes[i].motor2->OneStep(0);
+    }
+}
+
+
+void AF_MultiStepper::Release(void)
+{
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (_axes[i].motor != NULL)
+            _axes[i].motor->Release();
+        else
+            _axes[i].motor2->Release();
+    }
+}
+
+
+AF_StepperMotion& AF_MultiStepper::Motion(uint8_t axis)
+{
+    return (_axes[axis].motor != NULL) ? _axes[axis].motor->_motion : _axes[axis].motor2->_motion;
+}
+
+
+int32_t AF_MultiStepper::PositionUnits(uint8_t axis)
+{
+    return (_axes[axis].motor != NULL) ? _axes[axis].motor->PositionUnits() : _axes[axis].motor2->PositionUnits();
+}
+
+
+void AF_MultiStepper::Step(void)
+{
+    uint8_t stepped = 0;
+
+    // Every motor that steps opens a deferred update on its shield. The
+    // updates nest, so the last Commit() on each shield writes the coil
+    // frames of all its motors together.
+    for (uint8_t i=0; i < _count; i++)
+    {
+        Axis& axis = _axes[i];
+
+        axis.error += axis.steps;
+
+        if (axis.error < _leadSteps) continue;
+
+        axis.error -= _leadSteps;
+        stepped |= _BV(i);
+
+        if (axis.motor != NULL)
+        {
+            axis.motor->_controller->BeginUpdate();
+            axis.motor->OneStep(axis.dir);
+        }
+        else
+        {
+            axis.motor2->_controller->BeginUpdate();
+            axis.motor2->OneStep(axis.dir);
+        }
+    }
+
+    for (uint8_t i=0; i < _count; i++)
+    {
+        if (!(stepped & _BV(i))) continue;
+
+        if (_axes[i].motor != NULL)
+            _axes[i].motor->_controller->Commit();
+        else
+            _axes[i].motor2->_controller->Commit();
+    }
+
+    _motion.Stepped(1);
+}
+
+
+void AF_MultiStepper::UpdateProfile(void)
+{
+    uint32_t steps[AF_MULTI_STEPPER_AXES];
+    uint32_t minInterval;
+    uint32_t accel;
+    uint32_t jerk;
+
+    for (uint8_t i=0; i < _count; i++)  steps[i] = _axes[i].steps;
+
+    Limits(steps, _leadSteps, minInterval, accel, jerk);
+
+    _motion.SetProfile(1, minInterval, accel, jerk);
+}
+
+
+void AF_MultiStepper::Limits(const uint32_t* steps, uint32_t leadSteps, uint32_t& minInterval, uint32_t& accel, uint32_t& jerk)
+{
+    minInterval = 0;
+    accel = 0;
+    jerk = 0;
+
+    // A motor with a share d of the lead motor's D steps moves at d/D of its
+    // speed, so the lead motor can go D/d times as fast and accelerate D/d
+    // times as hard as that motor's own limits; the tightest limit wins. A
+    // motor without an acceleration or a jerk sets no limit on it.
+    for (uint8_t i=0; i < _count; i++)
+    {
+        AF_StepperMotion& motion = Motion(i);
+
+        if (steps[i] == 0) continue;
+
+        uint32_t interval = ((uint64_t)motion.MinInterval() * steps[i]) / leadSteps;
+
+        if (interval > minInterval) minInterval = interval;
+
+        if (motion.Accel() > 0)
+        {
+            uint64_t limit = ((uint64_t)motion.Accel() * leadSteps) / steps[i];
+
+            if (accel == 0 || limit < accel) accel = (limit > 0xFFFFFFFF) ? 0xFFFFFFFF : limit;
+        }
+
+        if (motion.Jerk() > 0)
+        {
+            uint64_t limit = ((uint64_t)motion.Jerk() * leadSteps) / steps[i];
+
+            if (jerk == 0 || limit < jerk) jerk = (limit > 0xFFFFFFFF) ? 0xFFFFFFFF : limit;
+        }
+    }
+}
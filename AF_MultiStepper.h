@@ -0,0 +1,193 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#ifndef _AF_MultiStepper_h_
+#define _AF_MultiStepper_h_
+
+#include <inttypes.h>
+#include <RTL_Stdlib.h>
+#include "AF_StepperMotion.h"
+
+
+class AF_StepperMotor;
+class AF_StepperMotor2;
+class AF_MotionQueue;
+
+
+#define AF_MULTI_STEPPER_AXES 4   // Maximum number of motors in a coordinated move
+
+//******************************************************************************
+/// Coordinated move of several stepper motors, on the same shield or on
+/// stacked shields, along a straight line: the motors start and finish
+/// together.
+///
+/// The motor with the most steps to go leads; the others are stepped along
+/// with it by integer Bresenham stepping, so each takes its share of steps
+/// spread evenly over the move. The speed, acceleration and jerk of the move
+/// are those of the lead motor, lowered where needed so that no motor goes
+/// faster or accelerates harder than its own settings allow.
+///
+/// Coil writes of the motors that step at the same time are sent together:
+/// one deferred update (BeginUpdate()/Commit()) per shield.
+//******************************************************************************
+class AF_MultiStepper
+{
+    DECLARE_CLASSNAME;
+
+    friend class AF_MotionQueue;
+
+    /*--------------------------------------------------------------------------
+    Constructors
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Constructor. The move has no motors.
+    //**************************************************************************
+    public: AF_MultiStepper(void);
+
+
+    /*--------------------------------------------------------------------------
+    Public methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Adds a motor to the move. The motors are numbered in the order they are
+    /// added, which is the order of the positions passed to MoveTo() and
+    /// Move(). Returns false if AF_MULTI_STEPPER_AXES motors were added
+    /// already, if the motor was added already, or if it is not on a shield.
+    //**************************************************************************
+    public: bool Add(AF_StepperMotor* motor);
+    public: bool Add(AF_StepperMotor2& motor);
+
+    //**************************************************************************
+    /// Starts a move to absolute positions, or by numbers of steps relative to
+    /// the current positions: one for each motor, in steps of each motor's own
+    /// mode (in micro-steps for a motor in the automatic mode). The calls
+    /// return at once: the motors are stepped by Service().
+    //**************************************************************************
+    public: void MoveTo(const int32_t* positions);
+    public: void Move(const int32_t* steps);
+
+    //**************************************************************************
+    /// Stops the move as soon as possible, still on the line: at once, or at
+    /// the end of the deceleration ramp.
+    //**************************************************************************
+    public: void Stop(void);
+
+    //**************************************************************************
+    /// Issues the next steps of the move if they are due. Call it from loop()
+    /// as often as possible, instead of the motors' own Service(). Returns true
+    /// while the move is under way.
+    //**************************************************************************
+    public: bool Service(void);
+
+    //**************************************************************************
+    /// Energizes the coils of all the motors at their current steps, so they
+    /// hold their positions (after Release()), or releases them all.
+    //**************************************************************************
+    public: void Hold(void);
+    public: void Release(void);
+
+
+    /*--------------------------------------------------------------------------
+    Public properties
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Gets the number of motors in the move.
+    //**************************************************************************
+    public: uint8_t Count() { return _count; };
+
+    //**************************************************************************
+    /// Gets the current position of a motor, as its own Position().
+    //**************************************************************************
+    public: int32_t Position(uint8_t axis) { return Motion(axis).Position() / PositionUnits(axis); };
+
+    //**************************************************************************
+    /// Gets whether the move is under way.
+    //**************************************************************************
+    public: bool IsRunning() { return _running; };
+
+
+    /*--------------------------------------------------------------------------
+    Internal methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Starts a move by numbers of steps, as in Motion(i).Unit(), that is one
+    /// of a path of moves joined without stopping: with the step interval of
+    /// the lead motor at the maximum speed, and entry and exit speeds in its
+    /// steps per second. For AF_MotionQueue.
+    //**************************************************************************
+    private: void Blend(const int32_t* togo, uint32_t minInterval, uint32_t entrySpeed, uint32_t exitSpeed);
+
+    //**************************************************************************
+    /// Sets up the motors for a move by numbers of steps, as in
+    /// Motion(i).Unit(), and finds the lead motor.
+    //**************************************************************************
+    private: void Prepare(const int32_t* togo);
+
+    //**************************************************************************
+    /// Gets the motion of a motor.
+    //**************************************************************************
+    private: AF_StepperMotion& Motion(uint8_t axis);
+
+    //**************************************************************************
+    /// Gets the size of the steps a motor's positions are given in.
+    //**************************************************************************
+    private: int32_t PositionUnits(uint8_t axis);
+
+    //**************************************************************************
+    /// Takes one step of the lead motor and the steps of the other motors that
+    /// fall on it.
+    //**************************************************************************
+    private: void Step(void);
+
+    //**************************************************************************
+    /// Sets the speed profile of the move from those of the motors.
+    //**************************************************************************
+    private: void UpdateProfile(void);
+
+    //**************************************************************************
+    /// Gets the step interval at the maximum speed, the acceleration and the
+    /// jerk of a move of the given steps of each motor, in steps of the lead
+    /// motor (0 for no limit on the acceleration or jerk).
+    //**************************************************************************
+    private: void Limits(const uint32_t* steps, uint32_t leadSteps, uint32_t& minInterval, uint32_t& accel, uint32_t& jerk);
+
+
+    /*--------------------------------------------------------------------------
+    Internal state
+    --------------------------------------------------------------------------*/
+
+    private: struct Axis
+    {
+        AF_StepperMotor*  motor;        // The motor, if an AF_StepperMotor
+        AF_StepperMotor2* motor2;       // The motor, if an AF_StepperMotor2
+        int8_t   dir;                   // Direction of the move
+        uint32_t steps;                 // Steps of the move
+        uint32_t error;                 // Bresenham accumulator
+    };
+
+    private: Axis     _axes[AF_MULTI_STEPPER_AXES];
+    private: uint8_t  _count;           // Number of motors
+    private: bool     _running;         // A move is under way
+    private: uint32_t _leadSteps;       // Steps of the motor with the most to go
+    private: AF_StepperMotion _motion;  // Position and timing of the move, in steps of the lead motor
+};
+
+#endif
@@ -0,0 +1,485 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#if (ARDUINO >= 100)
+ #include <Arduino.h>
+#else
+ #include <WProgram.h>
+#endif
+#include <RTL_Stdlib.h>
+#include "AF_StepEngine.h"
+
+#if AF_MS_ASYNC_I2C
+
+#include <avr/interrupt.h>
+
+
+#if (AF_STEP_QUEUE_SIZE & (AF_STEP_QUEUE_SIZE - 1)) || (AF_STEP_QUEUE_SIZE > 128)
+ #error "AF_STEP_QUEUE_SIZE must be a power of two, up to 128"
+#endif
+
+#if (F_CPU % 8000000UL) != 0
+ #error "AF_StepEngine needs a CPU clock that is a multiple of 8 MHz"
+#endif
+
+// Timer1 runs free at F_CPU/8
+#define TICKS_PER_US (F_CPU / 8000000UL)
+
+#define QUEUE_MASK  (AF_STEP_QUEUE_SIZE - 1)
+#define NO_MOTOR    0xFF                    // Slot of an event that only passes time
+#define MAX_DELTA   0x7FFF                  // Longest time between two events, in ticks
+#define LEAD        (20 * TICKS_PER_US)     // Shortest time the compare can be armed ahead
+#define RETRY       (20 * TICKS_PER_US)     // Time before a deferred coil write is tried again
+#define POLL        (500 * TICKS_PER_US)    // Time between looks at an empty queue while motors move
+
+
+/*******************************************************************************
+    Engine state, shared with the interrupt handler
+*******************************************************************************/
+
+// A queued step: the time since the previous event, the motor's slot, the
+// direction (to wind the step back if it is dropped) and the new coil state.
+struct StepEvent
+{
+    uint16_t     ticks;
+    uint8_t      slot;
+    int8_t       dir;
+    AF_StepEntry entry;
+};
+
+// An attached motor. The interrupt only uses the address, the register and
+// the channel offsets; the rest belongs to the planner.
+struct MotorSlot
+{
+    AF_StepperMotor* motor;
+    uint8_t  addr;              // I2C address of the motor's shield
+    uint8_t  reg;               // LEDn_ON_L register of the first channel of the port
+    uint8_t  offset[6];         // Channel of PWMA, PWMB, A2, B1, A1, B2 from the first one
+    bool     moving;            // The planner is scheduling steps for the motor
+    uint32_t due;               // Planner time of the motor's next step
+};
+
+// The planner (foreground) only moves _head and the interrupt only moves _tail
+static StepEvent _queue[AF_STEP_QUEUE_SIZE];
+static volatile uint8_t _head;
+static volatile uint8_t _tail;
+static volatile bool    _running;       // The compare interrupt is armed
+static volatile bool    _hold;          // Motors are moving: wait for more events when the queue is empty
+static volatile bool    _starved;       // The queue was found empty while motors were moving
+
+static MotorSlot _slots[AF_STEP_ENGINE_MOTORS];
+
+// Times are in timer ticks. The planner time runs from event to event; the
+// interrupt keeps the planner time of the events it has taken off the queue
+// (_doneTime) and the timer count at which the last one was due (_due).
+static uint32_t _planTime;
+static volatile uint32_t _doneTime;
+static uint16_t _due;
+
+static volatile uint32_t _steps;
+static volatile uint32_t _totalLate;
+static volatile uint16_t _maxLate;
+static volatile uint16_t _deferred;
+static volatile uint16_t _underruns;
+
+
+static inline void SetChannel(uint8_t* d, uint16_t value)
+{
+    // Same encoding as AF_MotorShield::SetPWMBlock(): 4096 is fully on, 0 off
+    d[0] = 0;
+    d[1] = (value > 4095) ? 0x10 : 0;
+    d[2] = (value > 4095) ? 0 : lowByte(value);
+    d[3] = (value > 4095) ? 0 : (value == 0) ? 0x10 : highByte(value);
+}
+
+
+// Queues the coil frame of a step on the TWI; false if the queue is in use or full
+static inline bool WriteStep(const StepEvent& ev)
+{
+    const MotorSlot& slot = _slots[ev.slot];
+    uint8_t data[1 + 6*4];
+    uint8_t latch = ev.entry.latch;
+
+    data[0] = slot.reg;
+
+    SetChannel(&data[1 + 4*slot.offset[0]], ev.entry.pwmA);
+    SetChannel(&data[1 + 4*slot.offset[1]], ev.entry.pwmB);
+    SetChannel(&data[1 + 4*slot.offset[2]], (latch & 0x1) ? 4096 : 0);
+    SetChannel(&data[1 + 4*slot.offset[3]], (latch & 0x2) ? 4096 : 0);
+    SetChannel(&data[1 + 4*slot.offset[4]], (latch & 0x4) ? 4096 : 0);
+    SetChannel(&data[1 + 4*slot.offset[5]], (latch & 0x8) ? 4096 : 0);
+
+    return AF_MS_AsyncTWI::tryWrite(slot.addr, data, sizeof(data));
+}
+
+
+ISR(TIMER1_COMPA_vect)
+{
+    for (;;)
+    {
+        if (_tail == _head)
+        {
+            if (!_hold)
+            {
+                TIMSK1 &= ~_BV(OCIE1A);
+                _running = false;
+                return;
+            }
+
+            // The planner is behind, or is holding back a long wait: look
+            // again shortly. _due is kept within reach of the 16-bit compares.
+            if ((uint16_t)(TCNT1 - _due) > MAX_DELTA) _due = TCNT1 - MAX_DELTA;
+
+            _starved = true;
+            OCR1A = TCNT1 + POLL;
+            return;
+        }
+
+        // Events are timed from the time the previous one was due, not from
+        // when it was written, so lateness does not accumulate. Events due
+        // within LEAD are written at once.
+        const StepEvent& ev = _queue[_tail];
+        uint16_t due = _due + ev.ticks;
+        int16_t wait = due - TCNT1;
+
+        if (wait > (int16_t)LEAD)
+        {
+            OCR1A = due;
+            return;
+        }
+
+        if (ev.slot != NO_MOTOR)
+        {
+            if (!WriteStep(ev))
+            {
+                // Try again shortly; the events after it keep their times
+                _deferred++;
+                OCR1A = TCNT1 + RETRY;
+                return;
+            }
+
+            int16_t late = TCNT1 - due;
+
+            if (late < 0) late = 0;
+
+            // A step that had to wait for the planner is an underrun; the
+            // steps after it are timed from it rather than rushed to catch up.
+            if (_starved && late > (int16_t)LEAD)
+            {
+                _underruns++;
+                due = TCNT1;
+                late = 0;
+            }
+
+            _steps++;
+            _totalLate += late;
+            if ((uint16_t)late > _maxLate) _maxLate = late;
+        }
+
+        _starved = false;
+        _due = due;
+        _doneTime += ev.ticks;
+        _tail = (_tail + 1) & QUEUE_MASK;
+    }
+}
+
+
+/*******************************************************************************
+    AF_StepEngine
+*******************************************************************************/
+
+void AF_StepEngine::Begin(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    TIMSK1 &= ~_BV(OCIE1A);
+    TCCR1A = 0;                 // Normal mode: the counter runs free
+    TCCR1B = _BV(CS11);         // clk/8
+    _head = _tail = 0;
+    _running = false;
+    _hold = false;
+    SREG = sreg;
+
+    _planTime = _doneTime = 0;
+
+    ResetStats();
+
+    // Let the shields' EmergencyStop() stop the engine
+    AF_MotorShield::_engineStop = Stop;
+}
+
+
+bool AF_StepEngine::Attach(AF_StepperMotor* motor)
+{
+    if (FindSlot(motor) >= 0) return true;
+
+    int8_t i = FindSlot(NULL);
+
+    if (i < 0) return false;
+
+    MotorSlot& slot = _slots[i];
+    uint8_t base = motor->_pinBase;
+
+    slot.addr = motor->_controller->_addr;
+    slot.reg = LED0_ON_L + 4*base;
+    slot.offset[0] = motor->_motorState.pinPWMA - base;
+    slot.offset[1] = motor->_motorState.pinPWMB - base;
+    slot.offset[2] = motor->_motorState.pinA2 - base;
+    slot.offset[3] = motor->_motorState.pinB1 - base;
+    slot.offset[4] = motor->_motorState.pinA1 - base;
+    slot.offset[5] = motor->_motorState.pinB2 - base;
+    slot.moving = false;
+
+    // Published last: the planner only looks at slots with a motor
+    slot.motor = motor;
+
+    return true;
+}
+
+
+void AF_StepEngine::Detach(AF_StepperMotor* motor)
+{
+    int8_t i = FindSlot(motor);
+
+    if (i < 0) return;
+
+    // Bring the motor to a stop (down its ramp, if it has one), and wait until
+    // its last step has been written. The other motors keep running.
+    motor->Stop();
+
+    while (motor->_motion.IsMoving()) Service();
+
+    uint32_t end = _planTime;
+
+    while (_running && (int32_t)(DoneTime() - end) < 0) Service();
+
+    _slots[i].motor = NULL;
+
+    // The engine wrote the coils behind the driver's back
+    motor->_controller->_pwm.invalidate();
+}
+
+
+void AF_StepEngine::Service(void)
+{
+    uint32_t doneTime = DoneTime();
+    bool moving = false;
+
+    for (;;)
+    {
+        // The motor whose next step is due first
+        int8_t next = -1;
+
+        for (uint8_t i = 0; i < AF_STEP_ENGINE_MOTORS; i++)
+        {
+            MotorSlot& slot = _slots[i];
+
+            if (slot.motor == NULL) continue;
+
+            if (!slot.motor->_motion.IsMoving())
+            {
+                slot.moving = false;
+                continue;
+            }
+
+            if (!slot.moving)
+            {
+                slot.moving = true;
+                slot.due = _planTime;
+            }
+
+            moving = true;
+
+            if (next < 0 || (int32_t)(slot.due - _slots[next].due) < 0) next = i;
+        }
+
+        if (next < 0) break;
+
+        if (((_head + 1) & QUEUE_MASK) == _tail) break;                       // Queue full
+        if (_planTime - doneTime > AF_STEP_ENGINE_LOOKAHEAD * TICKS_PER_US) break;  // Far enough ahead
+
+        MotorSlot& slot = _slots[next];
+        StepEvent& ev = _queue[_head];
+        uint32_t delta = slot.due - _planTime;
+
+        if (delta > MAX_DELTA)
+        {
+            // Longer than the timer can count in one go: pass time
+            ev.ticks = MAX_DELTA;
+            ev.slot = NO_MOTOR;
+        }
+        else
+        {
+            // The motor's speed profile gives the direction of the step and
+            // the time to the one after
+            AF_StepperMotor* motor = slot.motor;
+            int8_t dir = motor->_motion.Plan();
+
+            if (dir == 0)
+            {
+                slot.moving = false;
+                continue;
+            }
+
+            ev.ticks = delta;
+            ev.slot = next;
+            ev.dir = dir;
+            ev.entry = motor->NextStep(dir);
+
+            slot.due += motor->_motion.Interval() * TICKS_PER_US;
+        }
+
+        _planTime += ev.ticks;
+        _head = (_head + 1) & QUEUE_MASK;
+    }
+
+    // While motors move, the interrupt waits for the events still to come
+    _hold = moving;
+
+    if (!_running && _head != _tail) Start();
+}
+
+
+void AF_StepEngine::Stop(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    TIMSK1 &= ~_BV(OCIE1A);
+    _running = false;
+    _hold = false;
+    SREG = sreg;
+
+    // Wind back the steps that were planned but not written, newest first
+    while (_head != _tail)
+    {
+        _head = (_head - 1) & QUEUE_MASK;
+
+        const StepEvent& ev = _queue[_head];
+
+        if (ev.slot != NO_MOTOR) _slots[ev.slot].motor->NextStep(-ev.dir);
+    }
+
+    _planTime = _doneTime;
+
+    // The motors stand where the last written step left them, off their ramps
+    for (uint8_t i = 0; i < AF_STEP_ENGINE_MOTORS; i++)
+    {
+        AF_StepperMotor* motor = _slots[i].motor;
+
+        if (motor == NULL) continue;
+
+        motor->_motion.Position(motor->_motion.Position());
+        _slots[i].moving = false;
+    }
+}
+
+
+bool AF_StepEngine::IsRunning(void)
+{
+    if (_running) return true;
+
+    for (uint8_t i = 0; i < AF_STEP_ENGINE_MOTORS; i++)
+    {
+        if (_slots[i].motor != NULL && _slots[i].motor->IsRunning()) return true;
+    }
+
+    return false;
+}
+
+
+AF_StepEngineStats AF_StepEngine::Stats(void)
+{
+    AF_StepEngineStats stats;
+    uint8_t sreg = SREG;
+
+    cli();
+
+    uint32_t totalLate = _totalLate;
+
+    stats.steps = _steps;
+    stats.maxLate = _maxLate / TICKS_PER_US;
+    stats.deferred = _deferred;
+
+    stats.underruns = _underruns;
+
+    SREG = sreg;
+
+    stats.meanLate = (stats.steps > 0) ? totalLate / stats.steps / TICKS_PER_US : 0;
+
+    return stats;
+}
+
+
+void AF_StepEngine::ResetStats(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+    _steps = 0;
+    _totalLate = 0;
+    _maxLate = 0;
+    _deferred = 0;
+    _underruns = 0;
+    SREG = sreg;
+}
+
+
+uint32_t AF_StepEngine::DoneTime(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+
+    uint32_t doneTime = _doneTime;
+
+    SREG = sreg;
+
+    return doneTime;
+}
+
+
+int8_t AF_StepEngine::FindSlot(AF_StepperMotor* motor)
+{
+    for (uint8_t i = 0; i < AF_STEP_ENGINE_MOTORS; i++)
+    {
+        if (_slots[i].motor == motor) return i;
+    }
+
+    return -1;
+}
+
+
+void AF_StepEngine::Start(void)
+{
+    uint8_t sreg = SREG;
+
+    cli();
+
+    // The first event is written as soon as the compare is armed
+    OCR1A = TCNT1 + LEAD;
+    _due = OCR1A - _queue[_tail].ticks;
+    _starved = false;
+    TIFR1 = _BV(OCF1A);
+    TIMSK1 |= _BV(OCIE1A);
+    _running = true;
+
+    SREG = sreg;
+}
+
+#endif
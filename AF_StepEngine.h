@@ -0,0 +1,149 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#ifndef _AF_StepEngine_h_
+#define _AF_StepEngine_h_
+
+#include <inttypes.h>
+#include "AF_MotorShield.h"
+
+// The engine hands its coil writes to the interrupt-driven TWI queue from an
+// interrupt handler, so it needs the asynchronous bus (see AF_MS_I2CBus.h).
+#if AF_MS_ASYNC_I2C
+
+
+// Number of step events the planner can queue ahead of the timer. Must be a
+// power of two; each event takes 9 bytes of RAM.
+#ifndef AF_STEP_QUEUE_SIZE
+#define AF_STEP_QUEUE_SIZE 16
+#endif
+
+// Number of motors the engine can drive at once
+#ifndef AF_STEP_ENGINE_MOTORS
+#define AF_STEP_ENGINE_MOTORS 4
+#endif
+
+// How far ahead of the timer the planner fills the queue, in microseconds.
+// Service() must be called at least this often; a longer look-ahead tolerates
+// a busier loop(), but MoveTo() takes up to this long to take effect.
+#ifndef AF_STEP_ENGINE_LOOKAHEAD
+#define AF_STEP_ENGINE_LOOKAHEAD 10000
+#endif
+
+
+//******************************************************************************
+/// Step timing statistics of the engine, in microseconds. The lateness of a
+/// step is the time from its scheduled time to its coil write being queued.
+//******************************************************************************
+struct AF_StepEngineStats
+{
+    uint32_t steps;         // Steps written
+    uint16_t maxLate;       // Largest lateness of a step, not counting underruns
+    uint16_t meanLate;      // Average lateness of a step
+    uint16_t deferred;      // Coil writes put off because the I2C queue was busy or full
+    uint16_t underruns;     // Times the step queue ran dry while a motor was moving
+};
+
+
+//******************************************************************************
+/// Interrupt-driven step engine. Steps are timed by the Timer1 compare match
+/// interrupt instead of by polling, so the step rate stays steady while
+/// loop() is busy.
+///
+/// The foreground planner, Service(), works out the steps of the attached
+/// motors ahead of time and puts them in a fixed-size queue: which motor, and
+/// the coil currents of its new step. The interrupt takes the events off the
+/// queue when they are due and hands the coil frames to the TWI queue
+/// (AF_MS_AsyncTWI), which clocks them out in the background.
+///
+/// Motors are moved with their own MoveTo()/Move(), speed and acceleration;
+/// once a motor is attached, call AF_StepEngine::Service() instead of its
+/// own Service() or OneStep(), and do not change its mode while it moves.
+/// The motor's position runs ahead of the shaft by the steps in the queue.
+///
+/// NOTE: The engine takes over Timer1 (the Servo library also uses it).
+//******************************************************************************
+class AF_StepEngine
+{
+    /*--------------------------------------------------------------------------
+    Public methods
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Starts Timer1. Call it once in setup(), after the shields' Begin().
+    //**************************************************************************
+    public: static void Begin(void);
+
+    //**************************************************************************
+    /// Puts a motor under the control of the engine. Returns false if
+    /// AF_STEP_ENGINE_MOTORS motors are attached already.
+    //**************************************************************************
+    public: static bool Attach(AF_StepperMotor* motor);
+
+    //**************************************************************************
+    /// Stops a motor, down its deceleration ramp if it has an acceleration,
+    /// and gives it back to the foreground. Waits for its last step to be
+    /// written.
+    //**************************************************************************
+    public: static void Detach(AF_StepperMotor* motor);
+
+    //**************************************************************************
+    /// Plans the steps of the attached motors into the queue. Call it from
+    /// loop() at least every AF_STEP_ENGINE_LOOKAHEAD microseconds.
+    //**************************************************************************
+    public: static void Service(void);
+
+    //**************************************************************************
+    /// Stops all attached motors at once. The queued steps are dropped and the
+    /// positions of the motors are wound back to the last step written.
+    //**************************************************************************
+    public: static void Stop(void);
+
+    //**************************************************************************
+    /// Gets whether steps are queued or any attached motor has steps to go.
+    //**************************************************************************
+    public: static bool IsRunning(void);
+
+    //**************************************************************************
+    /// Gets or resets the step timing statistics.
+    //**************************************************************************
+    public: static AF_StepEngineStats Stats(void);
+    public: static void ResetStats(void);
+
+    /*--------------------------------------------------------------------------
+    Internal implementation
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Gets the index of the slot of a motor, or -1 if it is not attached.
+    //**************************************************************************
+    private: static int8_t FindSlot(AF_StepperMotor* motor);
+
+    //**************************************************************************
+    /// Gets the planner time of the last event the interrupt has taken off the
+    /// queue.
+    //**************************************************************************
+    private: static uint32_t DoneTime(void);
+
+    //**************************************************************************
+    /// Arms the timer for the event at the head of the queue.
+    //**************************************************************************
+    private: static void Start(void);
+};
+
+#endif
+#endif
@@ -0,0 +1,660 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#include <math.h>
+#include "AF_StepperMotion.h"
+
+
+// Integer square root, for the profile set-up
+static uint32_t SquareRoot(uint32_t x)
+{
+    uint32_t root = 0;
+    uint32_t bit = 1UL << 30;
+
+    while (bit > x) bit >>= 2;
+
+    while (bit != 0)
+    {
+        if (x >= root + bit)
+        {
+            x -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+
+        bit >>= 2;
+    }
+
+    return root;
+}
+
+
+// Integer cube root, rounded down, of a number below 2^57
+static uint32_t CubeRoot(uint64_t x)
+{
+    uint32_t root = 0;
+
+    for (int8_t shift = 54; shift >= 0; shift -= 3)
+    {
+        root <<= 1;
+
+        uint64_t b = 3 * (uint64_t)root * (root + 1) + 1;
+
+        if ((x >> shift) >= b)
+        {
+            x -= b << shift;
+            root++;
+        }
+    }
+
+    return root;
+}
+
+
+// Converts an acceleration in steps/s^2 to the fixed point of _rampK
+static uint32_t AccelK(float accel)
+{
+    return accel * 281.474977f;     // 2^48 / 10^12
+}
+
+
+// Gets the steps an S-curve from a standstill up to speed v takes, with
+// acceleration limit a and jerk j: v * (v/a + a/j) / 2 if it reaches a, or
+// v^1.5 / sqrt(j) if it does not.
+static float RampDistance(float v, float a, float j)
+{
+    return (v * j >= a * a) ? v * (v / a + a / j) / 2 : v * sqrt(v / j);
+}
+
+
+// Gets the steps in the three segments of an S-curve from a standstill up to
+// speed v (acceleration building, constant, easing off), and the acceleration
+// of the constant segment. The ends of the segments are rounded down, so the
+// curve never takes more room than it has.
+static void RampSegments(float v, float a, float j, uint32_t steps[3], float* peak)
+{
+    float tj;
+    float tc = 0;
+
+    if (v * j >= a * a)
+    {
+        tj = a / j;
+        tc = v / a - tj;
+    }
+    else
+    {
+        tj = sqrt(v / j);
+        a = j * tj;
+    }
+
+    float vj = j * tj * tj / 2;
+    float s1 = vj * tj / 3;
+    float s2 = s1 + vj * tc + a * tc * tc / 2;
+    float s3 = s2 + (vj + a * tc) * tj + a * tj * tj / 2 - s1;
+
+    steps[0] = (uint32_t)s1;
+    steps[1] = (uint32_t)s2 - steps[0];
+    steps[2] = (uint32_t)s3 - (uint32_t)s2;
+    *peak = a;
+}
+
+
+AF_StepperMotion::AF_StepperMotion(void)
+{
+    _position = 0;
+    _target = 0;
+    _nextStep = 0;
+    _moving = false;
+    _dir = 0;
+    _unit = AF_POSITION_UNITS;
+    _interval = 0;
+    _minInterval = 0;
+    _startInterval = 0;
+    _rampK = 0;
+    _rampSteps = 0;
+    _exitSteps = 0;
+    _accel = 0;
+    _jerk = 0;
+    _jerkK = 0;
+    _accelK = 0;
+    _peakAccelK = 0;
+    _peakInterval = 0;
+    _planTarget = 0;
+    _seg = 7;
+    _curve = false;
+}
+
+
+void AF_StepperMotion::SetProfile(uint8_t unit, uint32_t minInterval, uint32_t accel, uint32_t jerk)
+{
+    // Keep the fixed point below in range
+    if (accel > 8000000) accel = 8000000;
+    if (jerk > 200000000) jerk = 200000000;
+
+    _unit = unit;
+    _minInterval = minInterval << 8;
+    _accel = accel;
+    _jerk = jerk;
+
+    if (accel == 0)
+    {
+        _rampK = 0;
+        _rampSteps = 0;
+        return;
+    }
+
+    // q = a * p^2 with p in microseconds is a * p^2 / 10^12; keeping it in
+    // 8.24 fixed point gives p^2 * _rampK / 2^24.
+    _rampK = ((uint64_t)accel * 281474977ULL) / 1000000;       // 2^48 / 10^12 = 281.474977
+
+    // The first interval of a ramp is 1/v1, where v1 = sqrt(2a) is the speed
+    // after one step from a standstill.
+    _startInterval = (uint32_t)((1000000ULL << 16) / SquareRoot(2 * accel << 8) >> 4);
+
+    // The jerk changes the acceleration by j * p / 10^6 in a step of p us;
+    // as _rampK that is p * j * 2^48 / 10^18, or p * _jerkK / 2^16.
+    _jerkK = ((uint64_t)jerk * 18446744ULL) / 1000000;
+
+    if (jerk > 0)
+    {
+        // On an S-curve the first step takes t1 = (6/j)^(1/3), at the end of
+        // which the speed is j * t1^2 / 2, unless the acceleration limit
+        // keeps it to the trapezoid's. Both speeds in 24.8 fixed point, in
+        // integers so that a constant profile does not link in floating point.
+        uint32_t v1 = CubeRoot((uint64_t)jerk * 9 << 23);      // (4.5 j)^(1/3) * 2^8
+        uint32_t vmax = SquareRoot(2 * accel << 8) << 4;
+
+        if (v1 > vmax) v1 = vmax;
+
+        _startInterval = (uint32_t)((1000000ULL << 16) / v1);
+    }
+}
+
+
+void AF_StepperMotion::Blend(int32_t target, uint32_t entrySpeed, uint32_t exitSpeed)
+{
+    _target = _planTarget = target;
+    _exitSteps = RampSteps(exitSpeed);
+    _curve = false;
+    _rampSteps = RampSteps(entrySpeed);
+
+    if (_rampSteps == 0) return;
+
+    // Already on a ramp: carry on from the entry speed, in the direction of
+    // the new target
+    _dir = (target > _position) ? 1 : -1;
+    _interval = (uint32_t)(256e6f / entrySpeed);
+}
+
+
+uint32_t AF_StepperMotion::RampSteps(uint32_t speed)
+{
+    if (speed == 0 || _accel == 0) return 0;
+
+    // v^2 = 2 * a * n
+    float steps = (float)speed * speed / (2.0f * _accel);
+
+    return (steps < 1) ? 1 : (uint32_t)steps;
+}
+
+
+void AF_StepperMotion::Stop(void)
+{
+    _exitSteps = 0;
+
+    if (_rampK == 0 || _rampSteps == 0)
+    {
+        _target = _position;
+    }
+    else if (_curve)
+    {
+        if (_seg <= 3) StopCurve();
+
+        _target = _planTarget = _position + (int32_t)_dir * (int32_t)_rampSteps * _unit;
+    }
+    else
+    {
+        // Already slowing down for a target less than a step closer than
+        // that (the ramp count was rounded when the mode changed): keep it
+        int32_t stop = _position + (int32_t)_dir * (int32_t)_rampSteps * _unit;
+        int32_t past = (stop - _target) * _dir;
+
+        if (past <= 0 || past >= (int32_t)_unit) _target = stop;
+    }
+}
+
+
+bool AF_StepperMotion::IsMoving()
+{
+    int32_t togo = _target - _position;
+
+    return _rampSteps > _exitSteps || togo >= _unit || togo <= -(int32_t)_unit;
+}
+
+
+int8_t AF_StepperMotion::Due(uint32_t now)
+{
+    if (!_moving)
+    {
+        if (!IsMoving()) return 0;
+
+        _moving = true;
+        _nextStep = now;
+    }
+
+    if ((int32_t)(now - _nextStep) < 0) return 0;
+
+    int8_t dir = Plan();
+
+    if (dir == 0)
+    {
+        _moving = false;
+        return 0;
+    }
+
+    uint32_t interval = Interval();
+
+    _nextStep += interval;
+
+    // More than a whole step behind (loop() was held up, or the interval is
+    // shorter than the loop time): start over from now rather than issuing a
+    // burst of catch-up steps.
+    if ((int32_t)(now - _nextStep) >= 0) _nextStep = now + interval;
+
+    return dir;
+}
+
+
+int8_t AF_StepperMotion::Plan(void)
+{
+    int32_t togo = _target - _position;
+
+    if (_rampK == 0)
+    {
+        // No ramps: every step at the maximum speed
+        _interval = _minInterval;
+
+        return (togo >= _unit) ? 1 : (togo <= -(int32_t)_unit) ? -1 : 0;
+    }
+
+    if ((_rampSteps == 0) ? _jerkK != 0 : _curve) return PlanCurve(togo);
+
+    if (_rampSteps == 0)
+    {
+        // At rest: start a ramp towards the target. Done when less than a
+        // whole step is left (the target may fall between the steps of a
+        // coarser mode).
+        _dir = (togo >= _unit) ? 1 : (togo <= -(int32_t)_unit) ? -1 : 0;
+
+        if (_dir == 0) return 0;
+
+        // A move of a single step starts and ends its ramp at once
+        _curve = false;
+        _rampSteps = (togo >= 2 * (int32_t)_unit || togo <= -2 * (int32_t)_unit) ? 1 : 0;
+        _interval = (_startInterval > _minInterval) ? _startInterval : _minInterval;
+
+        return _dir;
+    }
+
+    // Units left in the direction of travel (negative if the target is now
+    // behind), against the units needed to slow down to the exit speed.
+    int32_t ahead = (_dir > 0) ? togo : -togo;
+    int32_t stop = (_rampSteps > _exitSteps) ? (int32_t)(_rampSteps - _exitSteps) * _unit : 0;
+
+    // At the end of a move joined to the next one: done, at the exit speed
+    if (_exitSteps != 0 && ahead < (int32_t)_unit) return 0;
+
+    if (ahead <= stop)
+    {
+        // Slow down. On the last step of the ramp the motor comes to rest; if
+        // the target is behind, the next step starts a ramp back to it.
+        _rampSteps--;
+        _interval = Slower(_interval, _rampK);
+
+        uint32_t slowest = (_startInterval > _minInterval) ? _startInterval : _minInterval;
+
+        if (_rampSteps == 0 || _interval > slowest) _interval = slowest;
+    }
+    else if (_interval > _minInterval)
+    {
+        // Speed up, unless one more step on the ramp would leave too little
+        // room to stop; then hold the speed for a step.
+        if (ahead > stop + _unit)
+        {
+            _rampSteps++;
+            _interval = Faster(_interval, _rampK);
+
+            if (_interval < _minInterval) _interval = _minInterval;
+        }
+    }
+    else if (_interval < _minInterval)
+    {
+        // The maximum speed was lowered: slow down to it
+        _rampSteps--;
+        _interval = Slower(_interval, _rampK);
+
+        if (_interval > _minInterval) _interval = _minInterval;
+    }
+
+    return _dir;
+}
+
+
+void AF_StepperMotion::Rescale(uint8_t unit)
+{
+    if (unit == _unit) return;
+
+    // Step sizes are powers of two, so one is a whole multiple of the other
+    bool coarser = unit > _unit;
+    uint8_t ratio = coarser ? unit / _unit : _unit / unit;
+
+    if (coarser)
+    {
+        _interval *= ratio;
+        _rampSteps = (_rampSteps + ratio - 1) / ratio;     // Still on the ramp if it was
+        _accelK /= ratio;
+        _peakAccelK /= ratio;
+        _peakInterval *= ratio;
+
+        for (uint8_t i=_seg; i < 7; i++)  _segSteps[i] /= ratio;
+    }
+    else
+    {
+        _interval /= ratio;
+        _rampSteps *= ratio;
+        _accelK *= ratio;
+        _peakAccelK *= ratio;
+        _peakInterval /= ratio;
+
+        for (uint8_t i=_seg; i < 7; i++)  _segSteps[i] *= ratio;
+    }
+
+    _unit = unit;
+
+    if (_rampSteps == 0) return;
+
+    int32_t togo = _target - _position;
+    int32_t ahead = ((_dir > 0) ? togo : -togo) / (int32_t)_unit;
+
+    if (!_curve)
+    {
+        // Rounding up may have left more steps to stop than there are to go
+        if (ahead >= 0 && _rampSteps > (uint32_t)ahead) _rampSteps = ahead;
+
+        return;
+    }
+
+    // The plan no longer adds up to the target exactly: the counts were
+    // rounded down, or the target lies between the coarser steps. Make up
+    // the difference in the cruise, if it is still ahead.
+    _rampSteps = 0;
+
+    for (uint8_t i=_seg; i < 7; i++)  _rampSteps += _segSteps[i];
+
+    if (_seg <= 3 && ahead > (int32_t)_rampSteps)
+    {
+        _segSteps[3] += ahead - _rampSteps;
+        _rampSteps = ahead;
+    }
+
+    NextSegment();
+}
+
+
+int8_t AF_StepperMotion::PlanCurve(int32_t togo)
+{
+    if (_rampSteps == 0)
+    {
+        _dir = (togo >= _unit) ? 1 : (togo <= -(int32_t)_unit) ? -1 : 0;
+
+        if (_dir == 0) return 0;
+
+        StartCurve(((_dir > 0) ? togo : -togo) / _unit);
+    }
+    else
+    {
+        if (_target != _planTarget) Retarget();
+
+        CurveStep();
+    }
+
+    _rampSteps--;
+    _segSteps[_seg]--;
+    NextSegment();
+
+    return _dir;
+}
+
+
+void AF_StepperMotion::StartCurve(uint32_t steps)
+{
+    float a = _accel;
+    float j = _jerk;
+    float v = (_minInterval > 0) ? 256e6f / _minInterval : 1e6f;
+    float half = steps / 2.0f;
+
+    // Peak speed: the maximum speed, or as fast as the move leaves room to
+    // get to and back down from, by solving RampDistance(v) = half for v.
+    if (RampDistance(v, a, j) > half)
+    {
+        float c = a * a / j;
+
+        v = (sqrt(c * c + 8 * a * half) - c) / 2;
+
+        if (v < c) v = pow(half * half * j, 1.0f / 3);
+    }
+
+    uint32_t ramp[3];
+    float peak;
+
+    RampSegments(v, a, j, ramp, &peak);
+
+    while (2 * (ramp[0] + ramp[1] + ramp[2]) > steps) ramp[ramp[2] ? 2 : ramp[1] ? 1 : 0]--;
+
+    // Slowing down mirrors speeding up
+    _segSteps[0] = _segSteps[6] = ramp[0];
+    _segSteps[1] = _segSteps[5] = ramp[1];
+    _segSteps[2] = _segSteps[4] = ramp[2];
+    _segSteps[3] = steps - 2 * (ramp[0] + ramp[1] + ramp[2]);
+
+    _peakAccelK = AccelK(peak);
+    _peakInterval = 256e6f / v;
+
+    if (_peakInterval < _minInterval) _peakInterval = _minInterval;
+
+    _curve = true;
+    _rampSteps = steps;
+    _planTarget = _target;
+    _seg = 0;
+    _accelK = 0;
+    _interval = (_startInterval > _peakInterval) ? _startInterval : _peakInterval;
+
+    NextSegment();
+
+    // The acceleration at the end of the first step is j * t1 = (6 j^2)^(1/3)
+    if (_seg == 0)
+    {
+        _accelK = AccelK(pow(6 * j * j, 1.0f / 3));
+
+        if (_accelK > _peakAccelK) _accelK = _peakAccelK;
+    }
+}
+
+
+void AF_StepperMotion::Retarget(void)
+{
+    _planTarget = _target;
+
+    // Already slowing down: the motor stops, and starts over from there
+    if (_seg > 3) return;
+
+    int32_t togo = _target - _position;
+    int32_t ahead = ((_dir > 0) ? togo : -togo) / (int32_t)_unit;
+
+    if (ahead < (int32_t)_rampSteps)
+    {
+        // Short of the plan, or behind: slow down now. If the target is
+        // still ahead of the stop, cruise to it first; if not, the motor
+        // overshoots and comes back.
+        StopCurve();
+
+        if (ahead <= (int32_t)_rampSteps) return;
+    }
+
+    // Further on: cruise for longer (at the peak speed of the plan, which is
+    // below the maximum if the move was short)
+    _segSteps[3] += ahead - _rampSteps;
+    _rampSteps = ahead;
+
+    if (_seg > 3) _seg = 3;
+}
+
+
+void AF_StepperMotion::StopCurve(void)
+{
+    float j = _jerk;
+    float v = 256e6f / _interval;
+    uint32_t ease = 0;
+
+    if (_seg < 3 && _accelK > 0)
+    {
+        // Ease the acceleration off first: for t = a/j, while the speed
+        // still rises by a^2 / 2j
+        float a = _accelK / 281.474977f;
+        float t = a / j;
+
+        ease = v * t + a * t * t / 2 - j * t * t * t / 6;
+        v += a * a / (2 * j);
+    }
+
+    uint32_t ramp[3];
+    float peak;
+
+    RampSegments(v, _accel, j, ramp, &peak);
+
+    _segSteps[0] = _segSteps[1] = _segSteps[3] = 0;
+    _segSteps[2] = ease;
+    _segSteps[4] = ramp[2];
+    _segSteps[5] = ramp[1];
+    _segSteps[6] = ramp[0];
+
+    // Take at least the step under way
+    if (ease + ramp[0] + ramp[1] + ramp[2] == 0) _segSteps[6] = 1;
+
+    _rampSteps = _segSteps[2] + _segSteps[4] + _segSteps[5] + _segSteps[6];
+    _peakAccelK = AccelK(peak);
+    _peakInterval = 256e6f / v;
+
+    if (_peakInterval < _minInterval) _peakInterval = _minInterval;
+
+    _seg = 2;
+
+    NextSegment();
+}
+
+
+void AF_StepperMotion::CurveStep(void)
+{
+    // The acceleration changes by the jerk times the time of the step
+    uint32_t p = _interval >> 8;
+
+    if (p > 0xFFFF) p = 0xFFFF;
+
+    uint32_t change = ((uint64_t)_jerkK * p) >> 16;
+    uint32_t accel = _accelK;
+
+    if (_seg == 0 || _seg == 4)
+    {
+        _accelK += change;
+
+        if (_accelK > _peakAccelK) _accelK = _peakAccelK;
+    }
+    else if (_seg == 2 || _seg == 6)
+    {
+        _accelK = (_accelK > change) ? _accelK - change : 0;
+    }
+
+    // The speed changes with the mean acceleration over the step
+    accel = (accel + _accelK) / 2;
+
+    if (_seg < 3)
+    {
+        _interval = Faster(_interval, accel);
+
+        if (_interval < _peakInterval) _interval = _peakInterval;
+    }
+    else if (_seg > 3)
+    {
+        _interval = Slower(_interval, accel);
+
+        if (_interval > _startInterval) _interval = _startInterval;
+    }
+}
+
+
+void AF_StepperMotion::NextSegment(void)
+{
+    while (_seg < 7 && _segSteps[_seg] == 0)
+    {
+        // The integration drifts a little; land on the planned acceleration
+        // and speed at the ends of the segments
+        if (_seg == 0 || _seg == 4) _accelK = _peakAccelK;
+        if (_seg == 2 || _seg == 6) _accelK = 0;
+        if (_seg == 2) _interval = _peakInterval;
+
+        _seg++;
+    }
+}
+
+
+uint32_t AF_StepperMotion::RampFactor(uint32_t interval, uint32_t k)
+{
+    // Intervals over 65ms are rare and only near a standstill, where the
+    // speed changes fastest anyway; they are clamped to keep p^2 in 32 bits.
+    uint32_t p = interval >> 8;
+
+    if (p > 0xFFFF) p = 0xFFFF;
+
+    // The series only holds for small q. It is 0.5 at the start of a
+    // trapezoid, and no more than that on an S-curve once clamped.
+    uint64_t q = ((uint64_t)(p * p) * k) >> 24;
+
+    return (q > 0x800000) ? 0x800000 : (uint32_t)q;
+}
+
+
+uint32_t AF_StepperMotion::Faster(uint32_t interval, uint32_t k)
+{
+    // p' = p / sqrt(1 + 2q) ~ p * (1 - q + 1.5 q^2)
+    uint64_t q = RampFactor(interval, k);
+    uint64_t r = q - ((3 * q * q) >> 25);
+
+    return interval - (uint32_t)((interval * r) >> 24);
+}
+
+
+uint32_t AF_StepperMotion::Slower(uint32_t interval, uint32_t k)
+{
+    // p' = p / sqrt(1 - 2q) ~ p * (1 + q + 1.5 q^2)
+    uint64_t q = RampFactor(interval, k);
+    uint64_t r = q + ((3 * q * q) >> 25);
+
+    return interval + (uint32_t)((interval * r) >> 24);
+}
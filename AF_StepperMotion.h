@@ -0,0 +1,259 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#ifndef _AF_StepperMotion_h_
+#define _AF_StepperMotion_h_
+
+#include <inttypes.h>
+
+
+// Position units per full step. Positions are kept in these units whatever the
+// stepping mode, so a motor can change modes without losing its position; one
+// step is AF_POSITION_UNITS for SINGLE and DOUBLE, half of it for INTERLEAVE,
+// and AF_POSITION_UNITS/microsteps for MICROSTEP.
+#define AF_POSITION_UNITS 64
+
+// With the automatic mode of the stepper classes, a mode is used only while
+// its step interval is at least this many times the measured time of its
+// OneStep(); the rest is left to loop() and the other motors.
+#ifndef AF_AUTO_MODE_HEADROOM
+#define AF_AUTO_MODE_HEADROOM 4
+#endif
+
+
+//******************************************************************************
+/// Position, speed profile and step timing of a stepper motor driven by
+/// polling. The stepper classes embed one and step the motor when Due() says
+/// so; it does no I/O itself.
+///
+/// Step deadlines are absolute micros() times: each deadline is the previous
+/// one plus the step interval, not the time the step was actually issued, so
+/// the time other motors and the rest of loop() take does not add up into a
+/// slower rate.
+///
+/// With an acceleration set, moves follow a trapezoidal profile: the motor
+/// speeds up from a standstill to the maximum speed, and slows down in time to
+/// stop at the target. The step interval is updated with a multiply-only
+/// recurrence (Eiderman), p' = p * (1 -/+ q + 1.5 q^2) where q = a * p^2, in
+/// fixed point; the number of steps taken on the ramp so far is also the
+/// number needed to stop (Austin), which tells where to start slowing down.
+/// There is no division or floating point per step.
+///
+/// With a jerk set as well, moves follow an S-curve instead: the acceleration
+/// itself ramps up and down, so there is no sudden change of force at the
+/// corners of the trapezoid. The seven segments of the move (acceleration
+/// building, constant and easing off; cruise; and the same for slowing down)
+/// are planned in steps when the move starts; each step then updates the
+/// acceleration and the interval with the same multiply-only recurrence, so
+/// the cost per step stays constant.
+//******************************************************************************
+class AF_StepperMotion
+{
+    //**************************************************************************
+    /// Constructor. The position and the target are 0.
+    //**************************************************************************
+    public: AF_StepperMotion(void);
+
+    //**************************************************************************
+    /// Sets the speed profile in terms of the steps of the current mode: the
+    /// size of a step in position units, the step interval at the maximum
+    /// speed in microseconds, the acceleration in steps per second per second
+    /// (0 for none: moves start and stop at the maximum speed), and the jerk in
+    /// steps per second cubed (0 for trapezoidal ramps), up to 8,000,000 and
+    /// 200,000,000 respectively. A trapezoidal ramp
+    /// follows changes at once; an S-curve move under way keeps its plan.
+    //**************************************************************************
+    public: void SetProfile(uint8_t unit, uint32_t minInterval, uint32_t accel, uint32_t jerk);
+
+    //**************************************************************************
+    /// Changes the size of a step in the middle of a move, for a motor that
+    /// switches modes on the fly: the speed and the acceleration stay the
+    /// same, so the step interval and the step counts of the ramp are scaled.
+    /// Call SetProfile() with the profile in steps of the new size right after.
+    //**************************************************************************
+    public: void Rescale(uint8_t unit);
+
+    //**************************************************************************
+    /// Gets the profile set with SetProfile().
+    //**************************************************************************
+    public: uint8_t Unit() { return _unit; };
+    public: uint32_t MinInterval() { return _minInterval >> 8; };
+    public: uint32_t Accel() { return _accel; };
+    public: uint32_t Jerk() { return _jerk; };
+
+    //**************************************************************************
+    /// Sets the target position, in position units.
+    //**************************************************************************
+    public: void MoveTo(int32_t target) { _target = target; };
+
+    //**************************************************************************
+    /// Sets the target of a move that is one of a path of moves joined without
+    /// stopping (see AF_MotionQueue): it starts at entrySpeed, which should be
+    /// the speed the last move left at, and ends at exitSpeed, in steps per
+    /// second. IsMoving() goes false when it reaches the target, while the
+    /// motor is still moving at exitSpeed: the next move must follow at once.
+    /// Trapezoidal ramps only: call it with a profile without a jerk.
+    //**************************************************************************
+    public: void Blend(int32_t target, uint32_t entrySpeed, uint32_t exitSpeed);
+
+    //**************************************************************************
+    /// Changes the exit speed of a move started with Blend(), in steps per
+    /// second, as the moves after it are planned.
+    //**************************************************************************
+    public: void ExitSpeed(uint32_t speed) { _exitSteps = RampSteps(speed); };
+
+    //**************************************************************************
+    /// Stops as soon as possible: at once without an acceleration, or at the
+    /// end of the deceleration ramp with one.
+    //**************************************************************************
+    public: void Stop(void);
+
+    //**************************************************************************
+    /// Gets whether a step is due at time 'now' (micros()). Returns the
+    /// direction of the step (+1 or -1) and schedules the next one, or returns
+    /// 0 if no step is due. The caller then steps the motor, and reports it
+    /// with Stepped(). The first step of a move is due at once.
+    //**************************************************************************
+    public: int8_t Due(uint32_t now);
+
+    //**************************************************************************
+    /// Decides the next step, for callers that do their own timing: returns its
+    /// direction, or 0 if the motor is at rest at the target, and advances the
+    /// speed profile. Interval() is then the time from this step to the next.
+    //**************************************************************************
+    public: int8_t Plan(void);
+
+    //**************************************************************************
+    /// Gets the time from the last planned step to the next, in microseconds.
+    //**************************************************************************
+    public: uint32_t Interval() { return _interval >> 8; };
+
+    //**************************************************************************
+    /// Records a step of 'delta' position units.
+    //**************************************************************************
+    public: void Stepped(int16_t delta) { _position += delta; };
+
+    //**************************************************************************
+    /// Gets whether the motor is moving: short of the target by at least one
+    /// step, or still on a ramp.
+    //**************************************************************************
+    public: bool IsMoving();
+
+    //**************************************************************************
+    /// Gets or sets the current position, in position units. Setting the
+    /// position also makes it the target, and ends any ramp, so the motor stops
+    /// there.
+    //**************************************************************************
+    public: int32_t Position() { return _position; };
+    public: void Position(int32_t position) { _position = _target = _planTarget = position; _rampSteps = _exitSteps = 0; };
+
+    //**************************************************************************
+    /// Gets the target position, in position units.
+    //**************************************************************************
+    public: int32_t Target() { return _target; };
+
+    /*--------------------------------------------------------------------------
+    Internal implementation
+    --------------------------------------------------------------------------*/
+
+    //**************************************************************************
+    /// Plans the next step of an S-curve move, like Plan().
+    //**************************************************************************
+    private: int8_t PlanCurve(int32_t togo);
+
+    //**************************************************************************
+    /// Plans the segments of an S-curve move of 'steps' steps from a
+    /// standstill.
+    //**************************************************************************
+    private: void StartCurve(uint32_t steps);
+
+    //**************************************************************************
+    /// Fits the plan under way to a new target: extends the cruise if the
+    /// target is further on, or slows down as soon as possible if it is not.
+    //**************************************************************************
+    private: void Retarget(void);
+
+    //**************************************************************************
+    /// Replans the rest of an S-curve move to stop as soon as possible: eases
+    /// off the acceleration, if any, and slows down from the speed reached.
+    /// Only for moves that are not slowing down yet.
+    //**************************************************************************
+    private: void StopCurve(void);
+
+    //**************************************************************************
+    /// Updates the acceleration and the interval for a step of the current
+    /// segment.
+    //**************************************************************************
+    private: void CurveStep(void);
+
+    //**************************************************************************
+    /// Moves on past finished segments, setting the acceleration and the
+    /// speed to their planned values at the end of each.
+    //**************************************************************************
+    private: void NextSegment(void);
+
+    //**************************************************************************
+    /// Gets the steps a ramp from a standstill takes to reach a speed in steps
+    /// per second (0 for a standstill, or without an acceleration).
+    //**************************************************************************
+    private: uint32_t RampSteps(uint32_t speed);
+
+    //**************************************************************************
+    /// Gets the step interval one step faster or slower on a ramp with
+    /// acceleration k (as _rampK).
+    //**************************************************************************
+    private: uint32_t Faster(uint32_t interval, uint32_t k);
+    private: uint32_t Slower(uint32_t interval, uint32_t k);
+
+    //**************************************************************************
+    /// Gets q = a * p^2 for a step interval p and acceleration k (as _rampK),
+    /// in 8.24 fixed point.
+    //**************************************************************************
+    private: uint32_t RampFactor(uint32_t interval, uint32_t k);
+
+    /*--------------------------------------------------------------------------
+    Internal state
+    --------------------------------------------------------------------------*/
+
+    private: int32_t  _position;        // Current position
+    private: int32_t  _target;          // Target position
+    private: uint32_t _nextStep;        // micros() deadline of the next step
+    private: bool     _moving;          // A move is under way (_nextStep is valid)
+    private: int8_t   _dir;             // Direction of travel on a ramp
+    private: uint8_t  _unit;            // Position units per step
+    private: uint32_t _interval;        // Time from the last step to the next (24.8 fixed point, us)
+    private: uint32_t _minInterval;     // Step interval at the maximum speed (24.8)
+    private: uint32_t _startInterval;   // First step interval of a ramp (24.8)
+    private: uint32_t _rampK;           // Acceleration as a * 2^48 / 10^12 (0 for no ramps)
+    private: uint32_t _rampSteps;       // Steps taken on the ramp, which is also the steps needed to stop;
+                                        // for an S-curve, steps left in the plan (0 at rest either way)
+    private: uint32_t _exitSteps;       // Ramp steps at the speed a Blend() move leaves at (0 to stop)
+
+    // S-curve moves
+    private: uint32_t _accel;           // Acceleration limit in steps/s^2
+    private: uint32_t _jerk;            // Jerk in steps/s^3 (0 for trapezoidal ramps)
+    private: uint32_t _jerkK;           // Jerk as j * 2^64 / 10^18: acceleration change per us of a step
+    private: uint32_t _accelK;          // Current acceleration, as _rampK
+    private: uint32_t _peakAccelK;      // Acceleration of the constant segments, as _rampK
+    private: uint32_t _peakInterval;    // Step interval of the cruise (24.8)
+    private: int32_t  _planTarget;      // Target the plan was made for
+    private: uint32_t _segSteps[7];     // Steps left in each segment
+    private: uint8_t  _seg;             // Current segment (7 when the plan is done)
+    private: bool     _curve;           // The move under way is an S-curve
+};
+
+#endif
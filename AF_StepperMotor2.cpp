@@ -21,6 +21,7 @@ Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
 #include <RTL_Stdlib.h>
 #include "AF_MotorShield2.h"
 #include "AF_StepperMotor2.h"
+#include "AF_StepperTables.h"
 
 
 DEFINE_CLASSNAME(AF_StepperMotor2);
@@ -35,6 +36,18 @@ AF_StepperMotor2::AF_StepperMotor2(void)
     _motorState.motorNum = 0;
     _stepsPerRev = 0;
     _currentStep = 0;
+    _microsteps = MICROSTEPS;
+    _microStride = AF_MicroStride(MICROSTEPS);
+    _microShift = AF_MicroShift(MICROSTEPS);
+    _usPerStep = 0;
+    _accel = 0;
+    _jerk = 0;
+    _autoMode = false;
+    _overrun = false;
+
+    for (uint8_t i=0; i < 4; i++)  _stepCost[i] = 0;
+
+    UpdateProfile();
 }
 
 
@@ -50,14 +63,23 @@ void AF_StepperMotor2::Configure(AF_MotorShield2* controller, uint8_t motorNum,
     _motorState.pinPWMB = pinPWMB; 
     _motorState.pinB1 = pinB1; 
     _motorState.pinB2 = pinB2; 
-    
-    Release();
+
+    _pinBase = min(min(min(pinPWMA, pinA1), min(pinA2, pinPWMB)), min(pinB1, pinB2));
+
+    // The pins are not released here: AF_MotorShield2::Begin() has either
+    // turned all outputs off already, or is keeping them after a warm start.
 }
 
 
 uint16_t AF_StepperMotor2::GetSpeed() 
 { 
-    uint16_t rpm = 60000000 / ((uint32_t)_stepsPerRev * (uint32_t)_usPerStep); 
+    // A step that takes longer to write than its interval holds the motor
+    // back to the time it takes
+    uint32_t usPerStep = (uint32_t)_stepCost[_motorState.mode] * (AF_POSITION_UNITS / StepUnits());
+
+    if (usPerStep < _usPerStep) usPerStep = _usPerStep;
+
+    uint16_t rpm = 60000000 / ((uint32_t)_stepsPerRev * usPerStep); 
     
     return rpm;
 }
@@ -66,11 +88,62 @@ uint16_t AF_StepperMotor2::GetSpeed()
 void AF_StepperMotor2::SetSpeed(uint16_t rpm) 
 {
     _usPerStep = 60000000 / ((uint32_t)_stepsPerRev * (uint32_t)rpm);
+
+    UpdateProfile();
+}
+
+
+uint16_t AF_StepperMotor2::GetMaxSpeed() 
+{ 
+    // No speed has been set yet
+    if (_usPerStep == 0) return 0;
+
+    return 1000000 / _usPerStep;
+}
+
+
+void AF_StepperMotor2::SetMaxSpeed(uint16_t stepsPerSecond) 
+{
+    if (stepsPerSecond == 0) return;
+
+    _usPerStep = 1000000 / (uint32_t)stepsPerSecond;
+
+    UpdateProfile();
+}
+
+
+void AF_StepperMotor2::SetAcceleration(uint16_t stepsPerSecond2) 
+{
+    _accel = stepsPerSecond2;
+
+    UpdateProfile();
+}
+
+
+void AF_StepperMotor2::SetJerk(uint32_t stepsPerSecond3) 
+{
+    _jerk = stepsPerSecond3;
+
+    UpdateProfile();
+}
+
+
+void AF_StepperMotor2::UpdateProfile(void) 
+{
+    // The profile is in steps of the current mode, scaled as in Run():
+    // INTERLEAVE halves the step interval and doubles the acceleration and
+    // jerk in steps, MICROSTEP divides and multiplies by the number of
+    // micro-steps.
+    uint8_t unit = StepUnits();
+    uint8_t stepsPerFullStep = AF_POSITION_UNITS / unit;
+
+    _motion.SetProfile(unit, _usPerStep / stepsPerFullStep, (uint32_t)_accel * stepsPerFullStep, _jerk * stepsPerFullStep);
 }
 
 
 void AF_StepperMotor2::Release(void) 
 {
+    _controller->BeginUpdate();
     _controller->SetPWM(_motorState.pinPWMA, 0);
     _controller->SetPin(_motorState.pinA1, LOW);
     _controller->SetPin(_motorState.pinA2, LOW);
@@ -78,6 +151,7 @@ void AF_StepperMotor2::Release(void)
     _controller->SetPWM(_motorState.pinPWMB, 0);
     _controller->SetPin(_motorState.pinB1, LOW);
     _controller->SetPin(_motorState.pinB2, LOW);
+    _controller->Commit();
 }
 
 
@@ -88,7 +162,25 @@ void AF_StepperMotor2::Run(int32_t steps, MotorMode mode, uint16_t speed)
 
     if (speed > 0) SetSpeed(speed);
     
-    SetMode(mode);
+    if (!_autoMode)
+        SetMode(mode);
+    else if (mode != _motorState.mode && PhaseAligned(mode))
+        SwitchMode(mode);       // Else the run starts in the current mode
+
+    _overrun = false;
+
+    if (_accel > 0 || _autoMode)
+    {
+        // With an acceleration the move is ramped, and in the automatic mode
+        // it changes modes, through the non-blocking API
+        uint8_t units = (mode == MICROSTEP) ? AF_POSITION_UNITS : ModeUnits(mode);
+
+        _motion.MoveTo(_motion.Position() + steps * units);
+
+        while (Service());
+
+        return;
+    }
     
     MotorDirection dir = (steps > 0) ? FORWARD : BACKWARD;
     uint32_t stepInterval = _usPerStep;
@@ -111,197 +203,281 @@ void AF_StepperMotor2::Run(int32_t steps, MotorMode mode, uint16_t speed)
         //       the motor will run at the correct RPM and travel the full distance.
         //       HOWEVER, at even moderate RPMs, the micro-step interval may become 
         //       shorter than the step loop time, so the RPM is effectively limited
-        //       by how fast the CPU can complete the step loop.
-        stepInterval /= MICROSTEPS;
-        steps *= MICROSTEPS;
+        //       by how fast the CPU can complete the step loop (GetOverrun() then
+        //       reads true).
+        stepInterval /= _microsteps;
+        steps *= _microsteps;
     }
         
+    // Each step is due stepInterval after the last one was due, not after it
+    // was written, so the time OneStep() takes is not added to the interval.
+    // A step that comes due before the last one is written is taken at once,
+    // and the timing starts over from there rather than catching up.
+    uint32_t due = micros();
+
     while (steps--) 
     {
-        OneStep(dir);
-        delayMicroseconds(stepInterval);
+        TimedStep(dir);
+
+        due += stepInterval;
+
+        uint32_t now = micros();
+
+        if ((int32_t)(now - due) > 0)
+        {
+            TRACE(Logger(_classname_, __func__, this) << F("[") << _motorState.motorNum 
+                                                      << F("] overrun, late=") << (now - due)
+                                                      << endl);
+            _overrun = true;
+            due = now;
+        }
+
+        while ((int32_t)(micros() - due) < 0);
+    }
+}
+
+
+void AF_StepperMotor2::SetMode(MotorMode mode) 
+{ 
+    // Carry the coil phase and the position over, as the automatic mode does
+    if (mode != _motorState.mode)
+        SwitchMode(mode);
+    else
+        UpdateProfile();
+}
+
+
+bool AF_StepperMotor2::SetMicrosteps(uint8_t microsteps) 
+{
+    uint8_t stride = AF_MicroStride(microsteps);
+
+    if (stride == 0) return false;
+
+    _microsteps = microsteps;
+    _microStride = stride;
+    _microShift = AF_MicroShift(microsteps);
+
+    if (_motorState.mode == MICROSTEP)
+    {
+        // Go back to a micro-step of the new resolution, and take the
+        // position with the coils
+        uint8_t entries = _currentStep & (stride - 1);
+
+        _currentStep -= entries;
+        _motion.Stepped(-(int16_t)entries * (AF_POSITION_UNITS / AF_MAX_MICROSTEPS));
+        _motion.Rescale(StepUnits());
     }
+
+    UpdateProfile();
+
+    return true;
 }
 
 
-#if (MICROSTEPS == 8)
-static uint8_t microstepcurve[] = {0,     50,     98,      142,      180,      212,      236,      250,      255};
-#elif (MICROSTEPS == 16)
-static uint8_t microstepcurve[] = {0, 25, 50, 74, 98, 120, 141, 162, 180, 197, 212, 225, 236, 244, 250, 253, 255};
-#endif
+// Step sequences indexed by the MotorMode value
+static const AF_StepSequence sequences[4] =
+{
+    AF_STEP_SEQUENCE(0, AF_StepperMotor2::INTERLEAVE, AF_StepperMotor2::MICROSTEP),
+    AF_STEP_SEQUENCE(1, AF_StepperMotor2::INTERLEAVE, AF_StepperMotor2::MICROSTEP),
+    AF_STEP_SEQUENCE(2, AF_StepperMotor2::INTERLEAVE, AF_StepperMotor2::MICROSTEP),
+    AF_STEP_SEQUENCE(3, AF_StepperMotor2::INTERLEAVE, AF_StepperMotor2::MICROSTEP),
+};
+
+
+AF_StepEntry AF_StepperMotor2::NextStep(int dir) 
+{
+    // Move to the next entry of the mode's step sequence. The entry gives the
+    // coil duties and the direction pin levels directly (see AF_StepperTables).
+    // If dir=+1 the sequence is walked forward, if dir=-1 backward.
+    // In MICROSTEP mode one micro-step spans _microStride table entries.
+    const AF_StepSequence& seq = sequences[_motorState.mode];
+    int delta = (_motorState.mode == MICROSTEP) ? dir * _microStride : dir;
+
+    _currentStep = (_currentStep + delta) & seq.mask;
+    _motion.Stepped(dir * StepUnits());
+
+    return AF_ReadStep(seq, _currentStep);
+}
 
 
 void AF_StepperMotor2::OneStep(int dir) 
 {
-    uint8_t latchState = 0;
-    uint8_t pwmA = 255;
-    uint8_t pwmB = 255;
+    AF_StepEntry step = NextStep(dir);
+
+    TRACE(Logger(_classname_, __func__, this) << F("[") << _motorState.motorNum << F("] _currentStep=") << _currentStep
+                                              << F(", PWMA=") << step.pwmA << F(", PWMB=") << step.pwmB
+                                              << F(", latchState=") << step.latch << endl);
+
+    // The six pins of a stepper port are consecutive PWM channels, so the
+    // whole coil frame goes out in a single burst transaction.
+    uint16_t frame[6];
+
+    frame[_motorState.pinPWMA - _pinBase] = step.pwmA;
+    frame[_motorState.pinPWMB - _pinBase] = step.pwmB;
+    frame[_motorState.pinA2 - _pinBase] = (step.latch & 0x1) ? 4096 : 0;
+    frame[_motorState.pinB1 - _pinBase] = (step.latch & 0x2) ? 4096 : 0;
+    frame[_motorState.pinA1 - _pinBase] = (step.latch & 0x4) ? 4096 : 0;
+    frame[_motorState.pinB2 - _pinBase] = (step.latch & 0x8) ? 4096 : 0;
 
-    switch(_motorState.mode)
+    _controller->SetPWMBlock(_pinBase, 6, frame);
+}
+
+
+void AF_StepperMotor2::MoveTo(int32_t position) 
+{
+    _overrun = false;
+    _motion.MoveTo(position * PositionUnits());
+}
+
+
+void AF_StepperMotor2::Move(int32_t steps) 
+{
+    _overrun = false;
+    _motion.MoveTo(_motion.Position() + steps * PositionUnits());
+}
+
+
+void AF_StepperMotor2::Stop(void) 
+{
+    _motion.Stop();
+}
+
+
+bool AF_StepperMotor2::Service(void) 
+{
+    int8_t dir = _motion.Due(micros());
+
+    if (dir != 0)
     {
-        case SINGLE:
-            //OneStep_Single(dir);
-            TRACE(Logger(_classname_, __func__, this) << "[" << _motorState.motorNum << F("] dir=") << dir << endl);
-
-            // Increment/decrement step number, but constrain to 0-3. 
-            // If dir=+1 then it steps 0-1-2-3 order, if dir=-1 then it steps 3-2-1-0 order
-            _currentStep = ((_currentStep + dir) + 4) % 4;
-
-            switch (_currentStep) 
-            {
-                case 0:
-                    latchState |= 0x3; // energize coil 1+2
-                    break;
-                    
-                case 1:
-                    latchState |= 0x6; // energize coil 2+3
-                    break;
-
-                case 2:
-                    latchState |= 0xC; // energize coil 3+4
-                    break;
-            
-                case 3:
-                    latchState |= 0x9; // energize coil 1+4
-                    break;
-            }
-
-            break;
-            
-        case DOUBLE:
-            //OneStep_Double(dir);
-            TRACE(Logger(_classname_, __func__, this) << "[" << _motorState.motorNum << F("] dir=") << dir << endl);
-
-            // Increment/decrement step number, but constrain to 0-3. 
-            // If dir=+1 then it steps 0-1-2-3 order, if dir=-1 then it steps 3-2-1-0 order
-            _currentStep = ((_currentStep + dir) + 4) % 4;    
-
-            switch (_currentStep) 
-            {
-                case 0:
-                    latchState |= 0x3; // energize coil 1+2
-                    break;
-                    
-                case 1:
-                    latchState |= 0x6; // energize coil 2+3
-                    break;
-
-                case 2:
-                    latchState |= 0xC; // energize coil 3+4
-                    break;
-            
-                case 3:
-                    latchState |= 0x9; // energize coil 1+4
-                    break;
-            }
-
-            break;
-            
-        case INTERLEAVE:
-            //OneStep_Interleave(dir);
-            TRACE(Logger(_classname_, __func__, this) << "[" << _motorState.motorNum << F("] dir=") << dir << endl);
-
-            // Increment/decrement step number, but constrain to 0-7. 
-            // If dir=+1 then it steps 0-1-2-3-4-5-6-7 order, if dir=-1 then it steps 7-6-5-4-3-2-1-0 order
-            _currentStep = ((_currentStep + dir) + 8) % 8;
-
-            switch (_currentStep) 
-            {
-                case 0:
-                    latchState |= 0x1; // energize coil 1 only
-                    break;
-                    
-                case 1:
-                    latchState |= 0x3; // energize coil 1+2
-                    break;
-                    
-                case 2:
-                    latchState |= 0x2; // energize coil 2 only
-                    break;
-                    
-                case 3:
-                    latchState |= 0x6; // energize coil 2+3
-                    break;
-                    
-                case 4:
-                    latchState |= 0x4; // energize coil 3 only
-                    break; 
-                    
-                case 5:
-                    latchState |= 0xC; // energize coil 3+4
-                    break;
-                    
-                case 6:
-                    latchState |= 0x8; // energize coil 4 only
-                    break;
-            
-                case 7:
-                    latchState |= 0x9; // energize coil 1+4
-                    break;
-            }
-            
-            break;
-            
-        case MICROSTEP:
-            //OneStep_Microstep(dir);
-            TRACE(Logger(_classname_, __func__, this) << F("[") << _motorState.motorNum << F("] dir=") << dir << endl);
-
-            // There are 16 (or 8) micro-steps per full motor step, and there are 4 steps 
-            // (or phases) to complete a full cycle. The 4 phases are:
-            //      Phase 0: coil A decreasing +, coil B increasing +
-            //      Phase 1: coil A increasing -, coil B decreasing +
-            //      Phase 2: coil A decreasing -, coil B increasing -
-            //      Phase 3: coil A increasing +, coil B decreasing -
-            //
-            // To keep track of both the phase and micro-step with a single variable,
-            // _currentStep, we count micro-steps in a full cycle, so there are 16*4 
-            // (or 8*4) micro-steps per cycle.
-            _currentStep = ((_currentStep + dir) + (MICROSTEPS*4)) % (MICROSTEPS*4);
-            
-            uint8_t phase = _currentStep / MICROSTEPS;
-            uint8_t microStep = _currentStep % MICROSTEPS;
-            
-            TRACE(Logger(_classname_, __func__, this) << F("[") << _motorState.motorNum << F("] _currentStep=") << _currentStep 
-			                                          << F(", phase=") << phase << F(", microStep=") << microStep << endl);
-
-            switch (phase)
-            {
-                case 0:
-                    pwmA = microstepcurve[MICROSTEPS - microStep];
-                    pwmB = microstepcurve[microStep];
-                    latchState |= 0x03;
-                    break;
-                    
-                case 1:
-                    pwmA = microstepcurve[microStep];
-                    pwmB = microstepcurve[MICROSTEPS - microStep];
-                    latchState |= 0x06;
-                    break;
-                
-                case 2:
-                    pwmA = microstepcurve[MICROSTEPS - microStep];
-                    pwmB = microstepcurve[microStep];
-                    latchState |= 0x0C;
-                    break;
-                
-                case 3:
-                    pwmA = microstepcurve[microStep];
-                    pwmB = microstepcurve[MICROSTEPS - microStep];
-                    latchState |= 0x09;
-                    break;
-            }
-
-            TRACE(Logger(_classname_, __func__, this) << F("[") << _motorState.motorNum << F("] PWMA=") << pwmA << F(", PWMB=") 
-			                                          << pwmB << F(", latchState=") << latchState << endl);
-
-            break;            
+        // A step that takes longer than the interval to the next one makes
+        // that one late
+        if (TimedStep(dir) > _motion.Interval()) _overrun = true;
+
+        if (_autoMode) AutoShift();
     }
-    
-    _controller->SetPWM(_motorState.pinPWMA, pwmA*16);
-    _controller->SetPWM(_motorState.pinPWMB, pwmB*16);
-    _controller->SetPin(_motorState.pinA2, (latchState & 0x1)  ? HIGH : LOW);
-    _controller->SetPin(_motorState.pinB1, (latchState & 0x2)  ? HIGH : LOW);
-    _controller->SetPin(_motorState.pinA1, (latchState & 0x4)  ? HIGH : LOW);
-    _controller->SetPin(_motorState.pinB2, (latchState & 0x8)  ? HIGH : LOW);
+
+    return _motion.IsMoving();
+}
+
+
+uint16_t AF_StepperMotor2::TimedStep(int dir) 
+{
+    uint8_t mode = _motorState.mode;
+    uint32_t start = micros();
+
+    OneStep(dir);
+
+    uint16_t cost = micros() - start;
+
+    // Running average over the last few steps
+    _stepCost[mode] = (_stepCost[mode] == 0) ? cost : (3 * (uint32_t)_stepCost[mode] + cost) / 4;
+
+    return cost;
+}
+
+
+void AF_StepperMotor2::AutoShift(void) 
+{
+    // The modes go MICROSTEP, INTERLEAVE, DOUBLE from fine to coarse
+    uint8_t mode = _motorState.mode;
+    uint32_t interval = _motion.Interval();
+    int32_t togo = _motion.Target() - _motion.Position();
+
+    if (togo < 0) togo = -togo;
+
+    if (mode == MICROSTEP || mode == INTERLEAVE)
+    {
+        // Too fast for this mode: change up, unless the move ends within a
+        // step of the coarser mode
+        MotorMode coarser = (mode == MICROSTEP) ? INTERLEAVE : DOUBLE;
+
+        if (interval < AF_AUTO_MODE_HEADROOM * (uint32_t)_stepCost[mode] && togo >= ModeUnits(coarser))
+        {
+            if (PhaseAligned(coarser)) SwitchMode(coarser);
+
+            return;
+        }
+    }
+
+    if (mode != MICROSTEP)
+    {
+        // Slow enough for the finer mode with some margin, so the modes do
+        // not flip back and forth; or the move ends within a step of this
+        // mode. A finer mode not measured yet is taken to cost the same.
+        // The steps of the modes are powers of two apart: a half step is
+        // _microsteps/2 micro-steps, a full step 2 half steps.
+        MotorMode finer = (mode == INTERLEAVE) ? MICROSTEP : INTERLEAVE;
+        uint16_t cost = (_stepCost[finer] != 0) ? _stepCost[finer] : _stepCost[mode];
+        uint8_t shift = (finer == MICROSTEP) ? _microShift - 1 : 1;
+        uint32_t fineInterval = interval >> shift;
+
+        if (fineInterval >= 2 * AF_AUTO_MODE_HEADROOM * (uint32_t)cost || togo < StepUnits()) SwitchMode(finer);
+    }
+}
+
+
+bool AF_StepperMotor2::PhaseAligned(MotorMode mode) 
+{
+    // The sequences meet at the half-step angles (see AF_StepperTables):
+    // micro-step entry i is at i * 90/AF_MAX_MICROSTEPS degrees, half step h
+    // at h * 45 and full step j at 45 + j * 90.
+    if (mode == MICROSTEP) return true;
+
+    if (_motorState.mode == MICROSTEP)
+    {
+        if (mode == INTERLEAVE) return (_currentStep % (AF_MAX_MICROSTEPS / 2)) == 0;
+
+        return (_currentStep % AF_MAX_MICROSTEPS) == AF_MAX_MICROSTEPS / 2;
+    }
+
+    if (_motorState.mode == INTERLEAVE) return (mode == INTERLEAVE) || (_currentStep & 1);
+
+    return true;
+}
+
+
+void AF_StepperMotor2::SwitchMode(MotorMode mode) 
+{
+    // The current step as a half step, and then as a step of the new mode
+    uint8_t before = Phase();
+    uint8_t half;
+
+    if (_motorState.mode == MICROSTEP)
+        half = _currentStep / (AF_MAX_MICROSTEPS / 2);
+    else if (_motorState.mode == INTERLEAVE)
+        half = _currentStep;
+    else
+        half = 2 * _currentStep + 1;
+
+    if (mode == MICROSTEP)
+        _currentStep = half * (AF_MAX_MICROSTEPS / 2);
+    else if (mode == INTERLEAVE)
+        _currentStep = half;
+    else
+        _currentStep = half / 2;
+
+    _motorState.mode = mode;
+
+    // Off a half-step angle the coils have moved by a fraction of a step
+    int16_t moved = (Phase() - before) & (4 * AF_MAX_MICROSTEPS - 1);
+
+    if (moved >= 2 * AF_MAX_MICROSTEPS) moved -= 4 * AF_MAX_MICROSTEPS;
+
+    _motion.Stepped(moved * (AF_POSITION_UNITS / AF_MAX_MICROSTEPS));
+    _motion.Rescale(StepUnits());
+
+    UpdateProfile();
+}
+
+
+uint8_t AF_StepperMotor2::Phase(void) 
+{
+    // As in PhaseAligned(): half step h is at h * 45 degrees and full step j
+    // at 45 + j * 90
+    if (_motorState.mode == MICROSTEP) return _currentStep;
+
+    if (_motorState.mode == INTERLEAVE) return _currentStep * (AF_MAX_MICROSTEPS / 2);
+
+    return _currentStep * AF_MAX_MICROSTEPS + AF_MAX_MICROSTEPS / 2;
 }
 
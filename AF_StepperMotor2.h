@@ -20,19 +20,21 @@ Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
 
 #include <inttypes.h>
 #include <IStepperMotor2.h>
+#include "AF_StepperTables.h"
+#include "AF_StepperMotion.h"
 
 
 class AF_MotorShield2;
 
 
-#define MICROSTEPS 8         // 8 or 16
-
 class AF_StepperMotor2 : public IStepperMotor2
 {
     DECLARE_CLASSNAME;
 
     friend class AF_MotorShield2;
 
+    // Coordinated moves step the motors and batch their coil writes
+    friend class AF_MultiStepper;
 
     /*--------------------------------------------------------------------------
     Constructors
@@ -60,11 +62,22 @@ class AF_StepperMotor2 : public IStepperMotor2
     /// NOTE: This is a blocking call - it will not return until the run has
     ///       completed. In the meantime, your Arduino will be doing nothing else.
     ///       This method is provided primarily for simple testing of stepper
-    ///       motors. The StepeprMotorController class provides an interface for
-    ///       more robust, non-blocking control of the motor.
+    ///       motors. MoveTo(), Move() and Service() provide non-blocking control
+    ///       of the motor.
     ///
     /// NOTE: The number of steps is always full motor steps for SINGLE, DOUBLE,
     ///       and MICROSTEP modes, and half-steps for INTERLEAVE mode.
+    ///
+    /// NOTE: With an acceleration set, the motor ramps up to speed and back
+    ///       down instead of starting and stopping at full speed.
+    ///
+    /// NOTE: With SetAutoMode(true), the mode is where the run starts; the
+    ///       motor changes modes as its speed changes.
+    ///
+    /// NOTE: Steps are timed from absolute deadlines, so the time OneStep()
+    ///       takes to write the coils comes out of the step interval instead
+    ///       of adding to it. If it takes longer than the interval, the motor
+    ///       runs slower than the speed set; see GetSpeed() and GetOverrun().
     //**************************************************************************
     public: void Run(int32_t steps, MotorMode mode = SINGLE, uint16_t speed=0);
 
@@ -79,6 +92,36 @@ class AF_StepperMotor2 : public IStepperMotor2
     //**************************************************************************
     public: void Release(void);
 
+    //**************************************************************************
+    /// Starts a move to an absolute position, or by a number of steps relative
+    /// to the current position. Positions and distances are in steps of the
+    /// current mode (half-steps for INTERLEAVE, micro-steps for MICROSTEP).
+    /// The calls return at once: the motor is stepped by Service().
+    //**************************************************************************
+    public: void MoveTo(int32_t position);
+    public: void Move(int32_t steps);
+
+    //**************************************************************************
+    /// Stops the motor as soon as possible: at once, or, with an acceleration
+    /// set, at the end of its deceleration ramp.
+    //**************************************************************************
+    public: void Stop(void);
+
+    //**************************************************************************
+    /// Issues the next step of a move if it is due, at the speed set with
+    /// SetSpeed() and the acceleration set with SetAcceleration(). Call it
+    /// from loop() as often as possible, for every motor that is moving; motors
+    /// on stacked shields are serviced the same way. Returns true while the
+    /// motor has not reached its target.
+    ///
+    /// NOTE: Steps are scheduled on absolute micros() deadlines, so the time
+    ///       spent elsewhere in loop() does not slow the motor down as long as
+    ///       the loop comes back within one step interval. If it falls further
+    ///       behind, the motor skips ahead in time instead of catching up with
+    ///       a burst of steps.
+    //**************************************************************************
+    public: bool Service(void);
+
     
     /*--------------------------------------------------------------------------
     Public properties
@@ -95,17 +138,115 @@ class AF_StepperMotor2 : public IStepperMotor2
     public: uint16_t StepsPerRev() { return _stepsPerRev; };
 
     //**************************************************************************
-    /// Gets or sets the motor mode.
+    /// Gets or sets the motor mode. The position is kept, and counted in steps
+    /// of the new mode from then on.
     //**************************************************************************
     public: MotorMode GetMode() { return (MotorMode)_motorState.mode; };
-    public: void SetMode(MotorMode mode) { _motorState.mode = mode; };
+    public: void SetMode(MotorMode mode);
 
     //**************************************************************************
-    /// Gets or sets the speed of the motor in RPM.
+    /// Gets or sets the number of micro-steps per full step used in MICROSTEP
+    /// mode: 8 (the default), 16, 32 or 64, up to AF_MAX_MICROSTEPS. Each motor
+    /// has its own setting, so a positioning axis can use 64 micro-steps while
+    /// a fast axis on the same shield uses 8. The coil currents come from a
+    /// 12-bit sine table. Returns false, and keeps the current setting, if the
+    /// value is not supported.
+    //**************************************************************************
+    public: uint8_t GetMicrosteps() { return _microsteps; };
+    public: bool SetMicrosteps(uint8_t microsteps);
+
+    //**************************************************************************
+    /// Gets or sets the automatic mode. When it is on, moves run by Service()
+    /// and Run() micro-step at low speeds and change to INTERLEAVE, then to
+    /// DOUBLE, as the speed rises, and back as it falls. A mode is used while
+    /// its steps are at least AF_AUTO_MODE_HEADROOM times as long as its
+    /// OneStep() takes (see GetStepCost()), so the motor is not held back by
+    /// the time it takes to write the coils. Modes change only where the coil
+    /// currents of both modes are the same, so no position is lost.
+    ///
+    /// NOTE: With the automatic mode on, positions and distances are in
+    ///       micro-steps, whatever the current mode. Motors moved by an
+    ///       AF_MultiStepper do not change modes.
+    //**************************************************************************
+    public: bool GetAutoMode() { return _autoMode; };
+    public: void SetAutoMode(bool enable) { _autoMode = enable; };
+
+    //**************************************************************************
+    /// Gets the average time OneStep() took in a mode, as measured by Run()
+    /// and Service(), in microseconds, or 0 if the mode was not used yet.
+    //**************************************************************************
+    public: uint16_t GetStepCost(MotorMode mode) { return _stepCost[mode]; };
+
+    //**************************************************************************
+    /// Gets whether the last run or move could not keep to the speed set: a
+    /// step took longer to write than the step interval, so the next one was
+    /// late. Cleared by Run(), MoveTo() and Move().
+    //**************************************************************************
+    public: bool GetOverrun() { return _overrun; };
+
+    //**************************************************************************
+    /// Gets or sets the speed of the motor in RPM. The speed read back is the
+    /// one the motor actually reaches in the current mode: the speed set, or
+    /// less if the measured time of a step (see GetStepCost()) is longer than
+    /// the step interval at that speed.
     //**************************************************************************
     public: uint16_t GetSpeed();
     public: void SetSpeed(uint16_t rpm);
 
+    //**************************************************************************
+    /// Gets or sets the maximum speed of the motor in full steps per second.
+    /// This is the same setting as the speed in RPM, in other units: moves run
+    /// at it once they have accelerated. It reads 0 until a speed is set; a
+    /// speed of 0 is ignored.
+    //**************************************************************************
+    public: uint16_t GetMaxSpeed();
+    public: void SetMaxSpeed(uint16_t stepsPerSecond);
+
+    //**************************************************************************
+    /// Gets or sets the acceleration of the motor in full steps per second per
+    /// second. With 0 (the default), moves start and stop at full speed;
+    /// otherwise MoveTo(), Move() and Run() ramp the speed up and down. The
+    /// speed and acceleration are in full steps in every mode: in INTERLEAVE
+    /// and MICROSTEP modes they are scaled to the half- or micro-steps.
+    //**************************************************************************
+    public: uint16_t GetAcceleration() { return _accel; };
+    public: void SetAcceleration(uint16_t stepsPerSecond2);
+
+    //**************************************************************************
+    /// Gets or sets the jerk of the motor in full steps per second cubed: how
+    /// fast the acceleration builds up and eases off. With 0 (the default),
+    /// ramps are trapezoidal and the acceleration changes at once at their
+    /// corners; otherwise moves follow an S-curve, which shakes a light
+    /// machine less and so may allow a higher speed. Needs an acceleration.
+    //**************************************************************************
+    public: uint32_t GetJerk() { return _jerk; };
+    public: void SetJerk(uint32_t stepsPerSecond3);
+
+    //**************************************************************************
+    /// Gets or sets the current position, in steps of the current mode (in
+    /// micro-steps with the automatic mode on). The position is counted from
+    /// 0 at start-up, and is kept across mode changes (in finer units, so a
+    /// position reached by micro-steps may read as a fraction of a full step,
+    /// rounded towards 0). Setting the position does not move the motor; it
+    /// stops any move under way.
+    //**************************************************************************
+    public: int32_t GetPosition() { return _motion.Position() / PositionUnits(); };
+    public: void SetPosition(int32_t position) { _motion.Position(position * PositionUnits()); };
+
+    //**************************************************************************
+    /// Gets the target position of the current move, and the distance left to
+    /// it, in steps of the current mode (in micro-steps with the automatic
+    /// mode on).
+    //**************************************************************************
+    public: int32_t GetTargetPosition() { return _motion.Target() / PositionUnits(); };
+    public: int32_t GetDistanceToGo() { return (_motion.Target() - _motion.Position()) / PositionUnits(); };
+
+    //**************************************************************************
+    /// Gets whether the motor is moving: short of its target by at least one
+    /// step, or still slowing down.
+    //**************************************************************************
+    public: bool IsRunning() { return _motion.IsMoving(); };
+
 
     /*--------------------------------------------------------------------------
     Internal implementation
@@ -116,6 +257,67 @@ class AF_StepperMotor2 : public IStepperMotor2
     //**************************************************************************
     private: void Configure(AF_MotorShield2* controller, uint8_t motorNum, uint8_t pinPWMA, uint8_t pinA1, uint8_t pinA2, uint8_t pinPWMB, uint8_t pinB1, uint8_t pinB2);
 
+    //**************************************************************************
+    /// Advances the step sequence and the position by one step in the
+    /// specified direction, and returns the new sequence entry. OneStep()
+    /// writes it to the coils.
+    //**************************************************************************
+    private: AF_StepEntry NextStep(int dir);
+
+    //**************************************************************************
+    /// Passes the speed and acceleration, in steps of the current mode, to the
+    /// motion profile. Called whenever one of them or the mode changes.
+    //**************************************************************************
+    private: void UpdateProfile(void);
+
+    //**************************************************************************
+    /// Changes to a coarser or finer mode in the automatic mode, if the speed
+    /// calls for it and the coils are at a step of both modes.
+    //**************************************************************************
+    private: void AutoShift(void);
+
+    //**************************************************************************
+    /// Takes one step with OneStep() and adds its time to the measured cost of
+    /// the mode. Returns the time it took, in microseconds.
+    //**************************************************************************
+    private: uint16_t TimedStep(int dir);
+
+    //**************************************************************************
+    /// Changes the mode, in the middle of a move too, keeping the speed. If
+    /// the current step is not a step of the new mode, the coils go to a step
+    /// of it next to the current one, and the position follows them.
+    //**************************************************************************
+    private: void SwitchMode(MotorMode mode);
+
+    //**************************************************************************
+    /// Gets the angle of the current step in the electrical cycle, in entries
+    /// of the micro-step table.
+    //**************************************************************************
+    private: uint8_t Phase(void);
+
+    //**************************************************************************
+    /// Gets whether the current step is also a step of another mode.
+    //**************************************************************************
+    private: bool PhaseAligned(MotorMode mode);
+
+    //**************************************************************************
+    /// Gets the size of one step of a mode, or of the current mode, in
+    /// position units.
+    //**************************************************************************
+    private: uint8_t ModeUnits(uint8_t mode)
+    {
+        return (mode == MICROSTEP) ? AF_POSITION_UNITS / _microsteps :
+               (mode == INTERLEAVE) ? AF_POSITION_UNITS / 2 : AF_POSITION_UNITS;
+    };
+
+    private: uint8_t StepUnits() { return ModeUnits(_motorState.mode); };
+
+    //**************************************************************************
+    /// Gets the size of the steps positions are given in, in position units:
+    /// steps of the current mode, or micro-steps in the automatic mode.
+    //**************************************************************************
+    private: uint8_t PositionUnits() { return _autoMode ? AF_POSITION_UNITS / _microsteps : StepUnits(); };
+
 
     /*--------------------------------------------------------------------------
     Internal state
@@ -134,9 +336,19 @@ class AF_StepperMotor2 : public IStepperMotor2
     }
     _motorState;
 
-    private: uint8_t  _currentStep;  // current step number
+    private: uint8_t  _currentStep;  // current step number (index in the step sequence)
+    private: uint8_t  _microsteps;   // Micro-steps per full step in MICROSTEP mode
+    private: uint8_t  _microStride;  // Micro-step table entries per micro-step
+    private: uint8_t  _microShift;   // Base-2 logarithm of _microsteps
+    private: uint8_t  _pinBase;      // Lowest of the six port pins (start of the coil frame)
     private: uint16_t _stepsPerRev;  // Number of steps per motor revolution
     private: uint32_t _usPerStep;    // microseconds per step
+    private: uint16_t _accel;        // Acceleration in full steps/s^2 (0 for none)
+    private: uint32_t _jerk;         // Jerk in full steps/s^3 (0 for trapezoidal ramps)
+    private: bool     _autoMode;     // Change modes with the speed
+    private: uint16_t _stepCost[4];  // Average time of OneStep() in each mode, in microseconds
+    private: bool     _overrun;      // A step of the last run or move was late
+    private: AF_StepperMotion _motion; // Position and step timing for Service()
     private: AF_MotorShield2* _controller;
 };
 
@@ -0,0 +1,105 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#include "AF_StepperTables.h"
+
+
+/*******************************************************************************
+    Full steps (SINGLE and DOUBLE) and half steps (INTERLEAVE): both coils
+    fully on, only the direction pins change.
+*******************************************************************************/
+
+const AF_StepEntry AF_FullStepTable[4] PROGMEM =
+{
+    { 4096, 4096, 0x3 },    // energize coil 1+2
+    { 4096, 4096, 0x6 },    // energize coil 2+3
+    { 4096, 4096, 0xC },    // energize coil 3+4
+    { 4096, 4096, 0x9 },    // energize coil 1+4
+};
+
+const AF_StepEntry AF_HalfStepTable[8] PROGMEM =
+{
+    { 4096, 4096, 0x1 },    // energize coil 1 only
+    { 4096, 4096, 0x3 },    // energize coil 1+2
+    { 4096, 4096, 0x2 },    // energize coil 2 only
+    { 4096, 4096, 0x6 },    // energize coil 2+3
+    { 4096, 4096, 0x4 },    // energize coil 3 only
+    { 4096, 4096, 0xC },    // energize coil 3+4
+    { 4096, 4096, 0x8 },    // energize coil 4 only
+    { 4096, 4096, 0x9 },    // energize coil 1+4
+};
+
+
+/*******************************************************************************
+    Micro-steps
+
+    There are AF_MAX_MICROSTEPS micro-steps per full step and 4 full steps
+    (phases) per cycle:
+        Phase 0: coil A decreasing +, coil B increasing +
+        Phase 1: coil A increasing -, coil B decreasing +
+        Phase 2: coil A decreasing -, coil B increasing -
+        Phase 3: coil A increasing +, coil B decreasing -
+    The coil currents follow a 12-bit sine curve computed at compile time. A
+    motor with fewer micro-steps walks the table with a larger stride.
+*******************************************************************************/
+
+#if (AF_MAX_MICROSTEPS != 8) && (AF_MAX_MICROSTEPS != 16) && (AF_MAX_MICROSTEPS != 32) && (AF_MAX_MICROSTEPS != 64)
+ #error "AF_MAX_MICROSTEPS must be 8, 16, 32 or 64"
+#endif
+
+// sin(x) for 0 <= x <= pi/2 (Taylor series to x^11, error below 1e-8)
+static constexpr double Sine(double x)
+{
+    return x * (1 - x*x/6 * (1 - x*x/20 * (1 - x*x/42 * (1 - x*x/72 * (1 - x*x/110)))));
+}
+
+// Quarter-wave curve: duty at micro-step k of a full step, 0 to 4096
+static constexpr uint16_t Curve(uint16_t k)
+{
+    return (uint16_t)(4096.0 * Sine(k * (3.14159265358979 / 2) / AF_MAX_MICROSTEPS) + 0.5);
+}
+
+static constexpr uint8_t phaseLatch[] = { 0x03, 0x06, 0x0C, 0x09 };
+
+// Coil A falls in even phases and rises in odd ones; coil B does the opposite
+static constexpr uint16_t CoilA(uint16_t i)
+{
+    return ((i / AF_MAX_MICROSTEPS) % 2 == 0) ? Curve(AF_MAX_MICROSTEPS - i % AF_MAX_MICROSTEPS) : Curve(i % AF_MAX_MICROSTEPS);
+}
+
+static constexpr uint16_t CoilB(uint16_t i)
+{
+    return ((i / AF_MAX_MICROSTEPS) % 2 == 0) ? Curve(i % AF_MAX_MICROSTEPS) : Curve(AF_MAX_MICROSTEPS - i % AF_MAX_MICROSTEPS);
+}
+
+#define STEP(i)     { CoilA(i), CoilB(i), phaseLatch[(i) / AF_MAX_MICROSTEPS] }
+#define STEP4(i)    STEP(i), STEP((i)+1), STEP((i)+2), STEP((i)+3)
+#define STEP16(i)   STEP4(i), STEP4((i)+4), STEP4((i)+8), STEP4((i)+12)
+#define STEP64(i)   STEP16(i), STEP16((i)+16), STEP16((i)+32), STEP16((i)+48)
+
+const AF_StepEntry AF_MicroStepTable[4*AF_MAX_MICROSTEPS] PROGMEM =
+{
+#if (AF_MAX_MICROSTEPS == 8)
+    STEP16(0), STEP16(16)
+#elif (AF_MAX_MICROSTEPS == 16)
+    STEP64(0)
+#elif (AF_MAX_MICROSTEPS == 32)
+    STEP64(0), STEP64(64)
+#else
+    STEP64(0), STEP64(64), STEP64(128), STEP64(192)
+#endif
+};
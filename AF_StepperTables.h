@@ -0,0 +1,114 @@
+/******************************************************************
+ This library is for the Adafruit Motor Shield V2 for Arduino. It
+ is adapted from the Adafruit library for the Motor Shield V2.
+ The library supports DC motors & Stepper motors with micro-stepping
+ as well as stacking-support.
+
+ It will only work with Adafruit Motor Shield V2.
+ See https://www.adafruit.com/products/1483
+
+ The original Adafruit library was written by Limor Fried/Ladyada for
+ Adafruit Industries. BSD license, check AdafruitLicense.txt for more
+ information.
+
+Original Copyright (c) 2012, Adafruit Industries.  All rights reserved.
+
+ This adaptation was written by R. Terry Lessly 2016-11-07.
+ ******************************************************************/
+#ifndef _AF_StepperTables_h_
+#define _AF_StepperTables_h_
+
+#include <inttypes.h>
+#if (ARDUINO >= 100)
+ #include <Arduino.h>
+#else
+ #include <WProgram.h>
+#endif
+
+
+#define MICROSTEPS 8            // Default micro-steps per full step of a motor
+
+// Finest micro-step resolution any motor can use: 8, 16, 32 or 64. A single
+// table at this resolution serves all coarser ones; lowering it saves flash
+// (5 bytes per micro-step and phase).
+#ifndef AF_MAX_MICROSTEPS
+#define AF_MAX_MICROSTEPS 64
+#endif
+
+
+//******************************************************************************
+/// One entry of a step sequence: the 12-bit PWM duty of both coils (0-4095,
+/// 4096 is fully on) and the levels of the four direction pins (bit 0 = A2,
+/// 1 = B1, 2 = A1, 3 = B2). The tables are in PROGMEM; read entries with
+/// AF_ReadStep().
+//******************************************************************************
+struct AF_StepEntry
+{
+    uint16_t pwmA;
+    uint16_t pwmB;
+    uint8_t  latch;
+};
+
+//******************************************************************************
+/// A step sequence for one stepping mode. The number of entries is a power of
+/// two, so the step index wraps with 'mask' (entries - 1).
+//******************************************************************************
+struct AF_StepSequence
+{
+    const AF_StepEntry* entries;
+    uint8_t mask;
+};
+
+extern const AF_StepEntry AF_FullStepTable[4] PROGMEM;             // SINGLE and DOUBLE
+extern const AF_StepEntry AF_HalfStepTable[8] PROGMEM;             // INTERLEAVE
+extern const AF_StepEntry AF_MicroStepTable[4*AF_MAX_MICROSTEPS] PROGMEM; // MICROSTEP
+
+//******************************************************************************
+/// Gets the sequence of a mode. The stepper classes use it to build a table
+/// indexed by their MotorMode values, whatever order those are in.
+//******************************************************************************
+#define AF_STEP_SEQUENCE(mode, INTERLEAVE, MICROSTEP) \
+    { ((mode) == (INTERLEAVE)) ? AF_HalfStepTable  : ((mode) == (MICROSTEP)) ? AF_MicroStepTable  : AF_FullStepTable, \
+      (uint8_t)(((mode) == (INTERLEAVE)) ? 8 - 1 : ((mode) == (MICROSTEP)) ? 4*AF_MAX_MICROSTEPS - 1 : 4 - 1) }
+
+//******************************************************************************
+/// Gets the step of the micro-step table that one micro-step of a motor
+/// running at 'microsteps' per full step spans, or 0 if that resolution is not
+/// supported (it must be a power of two no larger than AF_MAX_MICROSTEPS).
+//******************************************************************************
+inline uint8_t AF_MicroStride(uint8_t microsteps)
+{
+    if (microsteps == 0 || microsteps > AF_MAX_MICROSTEPS || (microsteps & (microsteps - 1))) return 0;
+
+    return AF_MAX_MICROSTEPS / microsteps;
+}
+
+//******************************************************************************
+/// Gets the base-2 logarithm of a supported micro-step resolution.
+//******************************************************************************
+inline uint8_t AF_MicroShift(uint8_t microsteps)
+{
+    uint8_t shift = 0;
+
+    while (microsteps > 1)
+    {
+        microsteps >>= 1;
+        shift++;
+    }
+
+    return shift;
+}
+
+//******************************************************************************
+/// Reads entry 'index' of a sequence from PROGMEM.
+//******************************************************************************
+inline AF_StepEntry AF_ReadStep(const AF_StepSequence& seq, uint8_t index)
+{
+    AF_StepEntry entry;
+
+    memcpy_P(&entry, &seq.entries[index], sizeof(entry));
+
+    return entry;
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+This is a test sketch for the Adafruit assembled Motor Shield for Arduino v2
+It won't work with v1.x motor shields! Only for the v2's with built in PWM
+control
+
+It drives eight steppers from four shields split over the two I2C buses of
+a board with two TWI peripherals (e.g. an Arduino Due): two shields on Wire
+and two on Wire1. Each bus carries half of the coil updates, so its
+traffic, and the load on its wiring, is half that of four stacked shields.
+
+The transfers do not overlap, though: the blocking Wire backend sends one
+transaction at a time, so the total step rate is about that of a single
+bus. The asynchronous backend (AF_MS_ASYNC_I2C) only drives the one TWI
+peripheral of the AVR boards and cannot be used here.
+
+For use with the Adafruit Motor Shield v2
+---->   http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+
+// Shields on different buses may use the same addresses
+AF_MotorShield AFMS[4] =
+{
+  AF_MotorShield(0x60, AF_MS_Wire),
+  AF_MotorShield(0x60, AF_MS_Wire1),
+  AF_MotorShield(0x61, AF_MS_Wire),
+  AF_MotorShield(0x61, AF_MS_Wire1)
+};
+
+AF_StepperMotor *steppers[8];
+
+
+void setup()
+{
+  Serial.begin(9600);
+  Serial.println("Dual Bus Test");
+
+  for (int i=0; i < 4; i++)
+  {
+    AFMS[i].Begin(1600, 400000);    // Each bus gets its own clock
+    steppers[2*i]   = AFMS[i].GetStepperMotor(0, 200);
+    steppers[2*i+1] = AFMS[i].GetStepperMotor(1, 200);
+  }
+
+  for (int i=0; i < 8; i++)
+  {
+    steppers[i]->Mode(AF_StepperMotor::DOUBLE);
+  }
+}
+
+
+void loop()
+{
+  uint32_t start = micros();
+
+  // Shields 0 and 2 are on Wire, 1 and 3 on Wire1, so consecutive shields
+  // alternate between the buses.
+  for (int n=0; n < 200; n++)
+  {
+    for (int i=0; i < 4; i++)
+    {
+      AFMS[i].BeginUpdate();
+      steppers[2*i]->OneStep(AF_StepperMotor::FORWARD);
+      steppers[2*i+1]->OneStep(AF_StepperMotor::FORWARD);
+      AFMS[i].Commit();
+    }
+  }
+
+  Serial.print("Time for 200 steps of 8 motors (us): ");
+  Serial.println(micros() - start);
+
+  for (int i=0; i < 8; i++) steppers[i]->Release();
+  delay(1000);
+}
@@ -0,0 +1,55 @@
+/*
+This sketch runs an XY stage from G-code sent over the serial port: G0/G1
+moves, G4 dwells, M17/M18 to energize or release the motors and M114 to
+report the positions. Each line is answered with "ok" once it is taken in,
+so a sender that waits for it (extras/gcode_stream.py, for instance) keeps
+the moves queued ahead, and the motors go from one into the next without
+stopping.
+
+For use with the Adafruit Motor Shield v2
+---->   http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+#include <AF_MultiStepper.h>
+#include <AF_MotionQueue.h>
+#include <AF_GCode.h>
+
+AF_MotorShield AFMS(0x60); // Default address, no jumpers
+
+// Connect two steppers with 200 steps per revolution (1.8 degree)
+AF_StepperMotor *xAxis = AFMS.GetStepperMotor(0, 200);
+AF_StepperMotor *yAxis = AFMS.GetStepperMotor(1, 200);
+
+AF_MultiStepper xy;
+AF_MotionQueue path(xy);
+AF_GCode gcode(path, Serial);
+
+
+void setup()
+{
+  Serial.begin(115200);
+
+  AFMS.Begin(); // Start the shield
+
+  xAxis->Mode(AF_StepperMotor::DOUBLE);
+  xAxis->MaxSpeed(500);
+  xAxis->Acceleration(1000);
+
+  yAxis->Mode(AF_StepperMotor::DOUBLE);
+  yAxis->MaxSpeed(500);
+  yAxis->Acceleration(1000);
+
+  xy.Add(xAxis);
+  xy.Add(yAxis);
+
+  // Positions in millimetres: 200 steps per turn of a lead screw of 8 mm
+  gcode.StepsPerUnit(0, 25);
+  gcode.StepsPerUnit(1, 25);
+}
+
+
+void loop()
+{
+  gcode.Service();
+}
@@ -0,0 +1,61 @@
+/* 
+This is a test sketch for the Adafruit assembled Motor Shield for Arduino v2
+It won't work with v1.x motor shields! Only for the v2's with built in PWM
+control
+
+It shows how to start and stop DC motors on two stacked shields at exactly
+the same time using a shield group. Every write through the group reaches
+all member shields in a single I2C transaction.
+
+For use with the Adafruit Motor Shield v2 
+---->   http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+#include <AF_MotorShieldGroup.h>
+
+AF_MotorShield AFMSbot(0x61); // Rightmost jumper closed
+AF_MotorShield AFMStop(0x60); // Default address, no jumpers
+
+// Both shields also answer to the PCA9685 ALLCALL address (0x70)
+AF_MotorShieldGroup group;
+
+// A DC motor on port M1 of each shield
+AF_DCMotor *botMotor = AFMSbot.GetDCMotor(0);
+AF_DCMotor *topMotor = AFMStop.GetDCMotor(0);
+
+
+void setup() 
+{
+  Serial.begin(9600);
+  Serial.println("Group Test");
+
+  AFMSbot.Begin(); // Start the bottom shield
+  AFMStop.Begin(); // Start the top shield
+
+  group.Add(AFMSbot);
+  group.Add(AFMStop);
+  group.Begin();   // Must follow the shields' Begin()
+
+  botMotor->Speed(200);
+  topMotor->Speed(200);
+}
+
+
+void loop() 
+{
+  // Port M1 uses pin 8 for PWM and pins 10/9 for direction. Setting them
+  // through the group starts both motors on the same STOP condition.
+  group.BeginUpdate();
+  group.SetPin(9, LOW);
+  group.SetPin(10, HIGH);
+  group.SetPWM(8, 200 * 16);
+  group.Commit();
+  delay(2000);
+
+  // Stop every output on every shield in one 6-byte transaction
+  group.EmergencyStop();
+  Serial.print("Stop latency (us): ");
+  Serial.println(group.StopLatency());
+  delay(2000);
+}
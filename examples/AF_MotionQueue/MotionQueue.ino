@@ -0,0 +1,62 @@
+/*
+This sketch moves an XY stage around a circle made of many short straight
+moves, as a dispensing path would be. The moves are queued ahead, so the
+motors go through the corners between them without stopping.
+
+For use with the Adafruit Motor Shield v2
+---->   http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+#include <AF_MultiStepper.h>
+#include <AF_MotionQueue.h>
+
+AF_MotorShield AFMS(0x60); // Default address, no jumpers
+
+// Connect two steppers with 200 steps per revolution (1.8 degree)
+AF_StepperMotor *xAxis = AFMS.GetStepperMotor(0, 200);
+AF_StepperMotor *yAxis = AFMS.GetStepperMotor(1, 200);
+
+AF_MultiStepper xy;
+AF_MotionQueue path(xy);
+
+// The circle, in steps, as 'sides' straight moves
+const int32_t radius = 400;
+const uint8_t sides = 36;
+uint8_t side = 0;
+
+
+void setup()
+{
+  Serial.begin(9600);
+  Serial.println("Motion queue");
+
+  AFMS.Begin(); // Start the shield
+
+  xAxis->Mode(AF_StepperMotor::DOUBLE);
+  xAxis->MaxSpeed(500);
+  xAxis->Acceleration(1000);
+
+  yAxis->Mode(AF_StepperMotor::DOUBLE);
+  yAxis->MaxSpeed(500);
+  yAxis->Acceleration(1000);
+
+  xy.Add(xAxis);
+  xy.Add(yAxis);
+}
+
+
+void loop()
+{
+  // Keep the queue full, so the speeds at the corners can be planned ahead
+  while (!path.IsFull())
+  {
+    float angle = 2 * PI * side / sides;
+    int32_t corner[2] = { (int32_t)(radius * sin(angle)), (int32_t)(radius - radius * cos(angle)) };
+
+    path.MoveTo(corner);
+    side = (side + 1) % sides;
+  }
+
+  path.Service();
+}
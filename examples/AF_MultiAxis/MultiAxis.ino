@@ -0,0 +1,71 @@
+/* 
+This sketch moves an XY stage with steppers on two stacked shields: X on the
+top shield and Y on the bottom one. The motors move together along straight
+lines, around a square and then across its diagonals, starting and finishing
+each side at the same time.
+
+For use with the Adafruit Motor Shield v2 
+---->   http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+#include <AF_MultiStepper.h>
+
+AF_MotorShield AFMSbot(0x61); // Rightmost jumper closed
+AF_MotorShield AFMStop(0x60); // Default address, no jumpers
+
+// Connect a stepper with 200 steps per revolution (1.8 degree) to each shield
+AF_StepperMotor *xAxis = AFMStop.GetStepperMotor(1, 200);
+AF_StepperMotor *yAxis = AFMSbot.GetStepperMotor(1, 200);
+
+AF_MultiStepper xy;
+
+// Corners of the square, then the diagonals, in steps
+const int32_t path[][2] =
+{
+  { 400, 0 }, { 400, 400 }, { 0, 400 }, { 0, 0 }, { 400, 400 }, { 400, 0 }, { 0, 400 }, { 0, 0 }
+};
+
+const uint8_t pathLength = sizeof(path) / sizeof(path[0]);
+uint8_t next = 0;
+
+
+void setup() 
+{
+  Serial.begin(9600);
+  Serial.println("Multi-axis moves");
+
+  AFMSbot.Begin(); // Start the bottom shield
+  AFMStop.Begin(); // Start the top shield
+
+  // Each axis has its own limits; a move runs as fast as the slowest axis
+  // allows for its share of the line.
+  xAxis->Mode(AF_StepperMotor::DOUBLE);
+  xAxis->MaxSpeed(400);
+  xAxis->Acceleration(800);
+
+  yAxis->Mode(AF_StepperMotor::DOUBLE);
+  yAxis->MaxSpeed(300);
+  yAxis->Acceleration(600);
+
+  xy.Add(xAxis);
+  xy.Add(yAxis);
+}
+
+
+void loop() 
+{
+  if (!xy.IsRunning())
+  {
+    xy.MoveTo(path[next]);
+
+    Serial.print("Moving to ");
+    Serial.print(path[next][0]);
+    Serial.print(", ");
+    Serial.println(path[next][1]);
+
+    next = (next + 1) % pathLength;
+  }
+
+  xy.Service();
+}
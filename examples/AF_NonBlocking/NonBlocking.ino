@@ -0,0 +1,69 @@
+/* 
+This sketch runs three steppers on two stacked shields at once, each at its
+own speed and in its own mode, without blocking loop(). It does the same as
+the Accel_MultiStepper example, without AccelStepper.
+
+For use with the Adafruit Motor Shield v2 
+---->   http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+
+AF_MotorShield AFMSbot(0x61); // Rightmost jumper closed
+AF_MotorShield AFMStop(0x60); // Default address, no jumpers
+
+// Connect two steppers with 200 steps per revolution (1.8 degree)
+// to the top shield
+AF_StepperMotor *myStepper1 = AFMStop.GetStepperMotor(0, 200);
+AF_StepperMotor *myStepper2 = AFMStop.GetStepperMotor(1, 200);
+
+// Connect one stepper with 200 steps per revolution (1.8 degree)
+// to the bottom shield
+AF_StepperMotor *myStepper3 = AFMSbot.GetStepperMotor(1, 200);
+
+
+void setup() 
+{
+  Serial.begin(9600);
+  Serial.println("Non-blocking steppers");
+
+  AFMSbot.Begin(); // Start the bottom shield
+  AFMStop.Begin(); // Start the top shield
+
+  // Positions are counted in steps of each motor's mode
+  myStepper1->Mode(AF_StepperMotor::SINGLE);
+  myStepper1->Speed(30);
+  myStepper1->MoveTo(24);
+
+  myStepper2->Mode(AF_StepperMotor::DOUBLE);
+  myStepper2->Speed(60);
+  myStepper2->MoveTo(50000);
+
+  myStepper3->Mode(AF_StepperMotor::INTERLEAVE);
+  myStepper3->Speed(90);
+  myStepper3->Acceleration(100); // Ramp up to speed and back down at the ends
+  myStepper3->MoveTo(1000000);
+}
+
+
+void loop() 
+{
+  // Change direction at the limits
+  if (myStepper1->DistanceToGo() == 0)
+    myStepper1->MoveTo(-myStepper1->Position());
+
+  if (myStepper2->DistanceToGo() == 0)
+    myStepper2->MoveTo(-myStepper2->Position());
+
+  if (myStepper3->DistanceToGo() == 0)
+    myStepper3->MoveTo(-myStepper3->Position());
+
+  // Each call issues a step only when that motor's next step is due
+  myStepper1->Service();
+  myStepper2->Service();
+  myStepper3->Service();
+
+  // The rest of the loop is free for other work, as long as it comes back
+  // within the shortest step interval (here 200 steps/rev at 90 RPM in half
+  // steps: about 1.7ms).
+}
@@ -0,0 +1,186 @@
+/* 
+This is a test sketch for the Adafruit assembled Motor Shield for Arduino v2
+It won't work with v1.x motor shields! Only for the v2's with built in PWM
+control
+
+It measures the step timing jitter of a micro-stepping motor three ways:
+  1. AF_StepperMotor::Run(), which blocks and times each step from an
+     absolute deadline
+  2. The polled Service() API, with loop() kept busy
+  3. The Timer1 interrupt step engine (AF_StepEngine), with loop() kept busy
+and prints the step period (min/mean/max) of each. The periods are taken
+from the TWI interrupt, at the end of each coil write, which is when the
+outputs of the shield change.
+
+The sketch needs the interrupt-driven I2C queue: set AF_MS_ASYNC_I2C to 1 in
+utility/AF_MS_I2CBus.h. It runs on AVR boards, and the step engine takes over
+Timer1.
+
+For use with the Adafruit Motor Shield v2 
+---->	http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+#include <AF_StepEngine.h>
+
+#if !AF_MS_ASYNC_I2C
+ #error "StepEngineJitter needs AF_MS_ASYNC_I2C set to 1 in utility/AF_MS_I2CBus.h"
+#endif
+
+// Create the motor shield object with the default I2C address
+AF_MotorShield AFMS = AF_MotorShield(); 
+
+// Connect a stepper motor with 200 steps per revolution (1.8 degree)
+AF_StepperMotor *myMotor = AFMS.GetStepperMotor(0, 200);
+
+static const uint16_t RPM = 30;
+static const uint8_t  USTEPS = 16;
+static const uint16_t STEPS = 200 * USTEPS;       // One revolution
+static const uint16_t BUSY = 2000;                // Longest simulated application work, us
+
+// Step periods, from the end of one coil write on the wire to the next. Set
+// by StepSent() in the TWI interrupt.
+static volatile uint32_t lastSent;
+static volatile uint32_t minPeriod, maxPeriod, totalPeriod;
+static volatile uint16_t periods;
+
+
+void setup() 
+{
+  Serial.begin(115200);
+  Serial.println("Step timing jitter");
+
+  AFMS.Begin(1600, 400000);
+
+  myMotor->Microsteps(USTEPS);
+  myMotor->Mode(AF_StepperMotor::MICROSTEP);
+  myMotor->Speed(RPM);
+
+  Serial.print("Nominal step period: ");
+  Serial.print(60000000UL / (200UL * RPM * USTEPS));
+  Serial.println(" us");
+
+  MeasureRun();
+  MeasureService();
+  MeasureEngine();
+
+  myMotor->Release();
+}
+
+
+void loop() 
+{
+}
+
+
+// Called by the TWI interrupt each time a coil write has been sent
+void StepSent(void)
+{
+  uint32_t now = micros();
+
+  if (lastSent != 0)
+  {
+    uint32_t period = now - lastSent;
+
+    if (period < minPeriod) minPeriod = period;
+    if (period > maxPeriod) maxPeriod = period;
+
+    totalPeriod += period;
+    periods++;
+  }
+
+  lastSent = now;
+}
+
+
+void StartPeriods(void)
+{
+  noInterrupts();
+  lastSent = 0;
+  minPeriod = 0xFFFFFFFF;
+  maxPeriod = 0;
+  totalPeriod = 0;
+  periods = 0;
+  interrupts();
+
+  AF_MS_AsyncTWI::onSent(StepSent);
+}
+
+
+void PrintPeriods(const char* label)
+{
+  // The last coil write has been timed once the queue is empty
+  AF_MS_AsyncTWI::flush();
+  AF_MS_AsyncTWI::onSent(NULL);
+
+  Serial.print(label);
+  Serial.print(" period min/mean/max ");
+  Serial.print(minPeriod);
+  Serial.print('/');
+  Serial.print(periods > 0 ? totalPeriod / periods : 0);
+  Serial.print('/');
+  Serial.print(maxPeriod);
+  Serial.println(" us");
+}
+
+
+// Stands in for the rest of an application: a random amount of work
+void BusyWork(void)
+{
+  uint32_t start = micros();
+  uint16_t busy = random(BUSY);
+
+  while (micros() - start < busy);
+}
+
+
+void MeasureRun(void)
+{
+  StartPeriods();
+
+  myMotor->Run(STEPS / USTEPS, AF_StepperMotor::MICROSTEP);
+
+  PrintPeriods("Run():       ");
+}
+
+
+void MeasureService(void)
+{
+  myMotor->Move(STEPS);
+  StartPeriods();
+
+  while (myMotor->Service()) BusyWork();
+
+  PrintPeriods("Service():   ");
+}
+
+
+void MeasureEngine(void)
+{
+  AF_StepEngine::Begin();
+  AF_StepEngine::Attach(myMotor);
+
+  myMotor->Move(STEPS);
+  StartPeriods();
+
+  while (AF_StepEngine::IsRunning())
+  {
+    AF_StepEngine::Service();
+    BusyWork();
+  }
+
+  PrintPeriods("AF_StepEngine:");
+
+  AF_StepEngineStats stats = AF_StepEngine::Stats();
+
+  Serial.print("AF_StepEngine: lateness mean/max ");
+  Serial.print(stats.meanLate);
+  Serial.print('/');
+  Serial.print(stats.maxLate);
+  Serial.print(" us, deferred writes ");
+  Serial.print(stats.deferred);
+  Serial.print(", underruns ");
+  Serial.println(stats.underruns);
+
+  AF_StepEngine::Detach(myMotor);
+}
@@ -0,0 +1,71 @@
+/* 
+This is a test sketch for the Adafruit assembled Motor Shield for Arduino v2
+It won't work with v1.x motor shields! Only for the v2's with built in PWM
+control
+
+It measures how many OneStep() calls per second a stepper motor can make at
+each I2C bus clock supported by the PCA9685: Standard-mode (100 kHz), 
+Fast-mode (400 kHz) and Fast-mode Plus (1 MHz). Long or heavily loaded bus
+wiring may not work at the higher clocks.
+
+For use with the Adafruit Motor Shield v2 
+---->	http://www.adafruit.com/products/1438
+*/
+
+#include <AF_MotorShield.h>
+
+// Create the motor shield object with the default I2C address
+AF_MotorShield AFMS = AF_MotorShield(); 
+
+// Connect a stepper motor with 200 steps per revolution (1.8 degree)
+AF_StepperMotor *myMotor = AFMS.GetStepperMotor(0, 200);
+
+static const uint32_t clocks[] = { 100000, 400000, 1000000 };
+static const uint16_t STEPS = 1000;
+
+
+void setup() 
+{
+  Serial.begin(115200);
+  Serial.println("OneStep() throughput vs. I2C clock");
+
+  for (uint8_t i = 0; i < sizeof(clocks) / sizeof(clocks[0]); i++)
+  {
+    AFMS.Begin(1600, clocks[i]);
+
+    Serial.print("Requested ");
+    Serial.print(clocks[i]);
+    Serial.print(" Hz, applied ");
+    Serial.print(AFMS.I2CClock());
+    Serial.println(" Hz");
+
+    Measure(AF_StepperMotor::DOUBLE, "  DOUBLE:     ");
+    Measure(AF_StepperMotor::INTERLEAVE, "  INTERLEAVE: ");
+    Measure(AF_StepperMotor::MICROSTEP, "  MICROSTEP:  ");
+
+    myMotor->Release();
+  }
+}
+
+
+void loop() 
+{
+}
+
+
+void Measure(AF_StepperMotor::MotorMode mode, const char* label)
+{
+  myMotor->Mode(mode);
+
+  uint32_t start = micros();
+
+  for (uint16_t i = 0; i < STEPS; i++)  myMotor->OneStep(AF_StepperMotor::FORWARD);
+
+  uint32_t elapsed = micros() - start;
+
+  Serial.print(label);
+  Serial.print(elapsed / STEPS);
+  Serial.print(" us/step, ");
+  Serial.print(1000000UL * STEPS / elapsed);
+  Serial.println(" steps/s");
+}
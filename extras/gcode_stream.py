@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Streams a G-code file to a board running AF_GCode.
+
+Each line is sent when the one before has been answered with "ok", so the
+board's motion queue is kept full without overrunning its serial buffer.
+Answers other than "ok" and "error: ..." (M114 positions) are printed.
+
+    gcode_stream.py /dev/ttyACM0 program.gcode [--baud 115200]
+
+The port may also be a pseudo-terminal, to run a program against the library
+built for the host. Uses only the Python standard library (POSIX).
+"""
+
+import argparse
+import os
+import sys
+import termios
+import time
+
+
+def open_port(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attrs = termios.tcgetattr(fd)
+    # Raw 8N1, no echo, no line editing
+    attrs[0] = 0
+    attrs[1] = 0
+    attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attrs[3] = 0
+    speed = getattr(termios, "B%d" % baud)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return os.fdopen(fd, "r+b", buffering=0)
+
+
+def read_line(port):
+    line = bytearray()
+    while True:
+        c = port.read(1)
+        if not c:
+            raise EOFError("port closed")
+        if c == b"\n":
+            return line.decode("ascii", "replace").strip()
+        line += c
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("port")
+    parser.add_argument("program")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--reset-wait", type=float, default=0,
+                        help="seconds to wait after opening the port, for boards that reset")
+    args = parser.parse_args()
+
+    port = open_port(args.port, args.baud)
+    time.sleep(args.reset_wait)
+
+    errors = 0
+    start = time.time()
+
+    with open(args.program) as program:
+        for number, line in enumerate(program, 1):
+            line = line.strip()
+            if not line:
+                continue
+
+            port.write(line.encode("ascii") + b"\n")
+
+            while True:
+                answer = read_line(port)
+                if answer == "ok":
+                    break
+                if answer.startswith("error"):
+                    print("%d: %s: %s" % (number, line, answer), file=sys.stderr)
+                    errors += 1
+                    break
+                print(answer)
+
+    print("%.2f s, %d errors" % (time.time() - start, errors), file=sys.stderr)
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,61 @@
+/***************************************************
+  The GCode example on the host: an XY stage driven by AF_GCode, reading
+  its lines from a pseudo-terminal, with the shield on the loopback bus.
+
+      gcode_host <transcript>
+
+  Prints the name of the pseudo-terminal to send the G-code to, then runs
+  until the sender has closed it and the moves have ended. Every answer is
+  copied to the transcript. test_gcode.py runs extras/gcode_stream.py
+  against it.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#include <AF_MotorShield.h>
+#include <AF_MultiStepper.h>
+#include <AF_MotionQueue.h>
+#include <AF_GCode.h>
+#include "pty_stream.h"
+
+
+int main(int argc, char** argv)
+{
+  PtyStream port;
+
+  if (argc != 2 || !port.open(argv[1]))
+  {
+    fprintf(stderr, "usage: gcode_host <transcript>\n");
+    return 2;
+  }
+
+  AF_MotorShield AFMS(0x60);
+  AF_StepperMotor* xAxis = AFMS.GetStepperMotor(0, 200);
+  AF_StepperMotor* yAxis = AFMS.GetStepperMotor(1, 200);
+  AF_MultiStepper xy;
+  AF_MotionQueue path(xy);
+  AF_GCode gcode(path, port);
+
+  AFMS.Begin();
+
+  xAxis->Mode(AF_StepperMotor::DOUBLE);
+  xAxis->MaxSpeed(2000);
+  xAxis->Acceleration(8000);
+
+  yAxis->Mode(AF_StepperMotor::DOUBLE);
+  yAxis->MaxSpeed(2000);
+  yAxis->Acceleration(8000);
+
+  xy.Add(xAxis);
+  xy.Add(yAxis);
+
+  gcode.StepsPerUnit(0, 10);
+  gcode.StepsPerUnit(1, 10);
+
+  printf("%s\n", port.slave());
+  fflush(stdout);
+
+  while (gcode.Service() || !port.hungUp());
+
+  return 0;
+}
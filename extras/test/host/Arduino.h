@@ -0,0 +1,99 @@
+/***************************************************
+  Minimal Arduino API for building the library on a Linux host, so that the
+  tests in extras/test can run it on the in-memory buses. Only what the
+  library itself uses is provided. Time is the host's monotonic clock, or
+  with HOST_SIMULATED_CLOCK a clock of the test's own (see micros()).
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#ifndef _HOST_Arduino_h_
+#define _HOST_Arduino_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define ARDUINO_HOST 1
+
+#define LOW 0
+#define HIGH 1
+
+#define PROGMEM
+#define memcpy_P memcpy
+
+#define _BV(b) (1 << (b))
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define constrain(x, a, b) ((x) < (a) ? (a) : (x) > (b) ? (b) : (x))
+
+typedef bool boolean;
+
+template<class T> T min(T a, T b) { return (a < b) ? a : b; }
+template<class T> T max(T a, T b) { return (a > b) ? a : b; }
+
+
+#ifdef HOST_SIMULATED_CLOCK
+
+// The test defines the clock. Every reading moves it on by hostClockTick
+// microseconds, so the timing of the motion code does not depend on the load
+// of the machine, and busy waits end.
+extern uint32_t hostMicros;
+extern uint32_t hostClockTick;
+
+inline uint32_t micros(void) { return hostMicros += hostClockTick; }
+
+#else
+
+inline uint32_t micros(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  return (uint32_t)(t.tv_sec * 1000000ULL + t.tv_nsec / 1000);
+}
+
+#endif
+
+inline uint32_t millis(void) { return micros() / 1000; }
+
+inline void delayMicroseconds(uint32_t us)
+{
+  uint32_t start = micros();
+
+  while (micros() - start < us);
+}
+
+
+// Strings in flash are plain strings on the host
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+
+// The Stream interface the library reads commands from and answers on. A
+// test derives its own stream from it (see gcode_host.cpp).
+class Stream {
+ public:
+  virtual ~Stream(void) {}
+
+  virtual int available(void) = 0;
+  virtual int read(void) = 0;
+  virtual size_t write(const uint8_t* data, size_t len) = 0;
+
+  size_t print(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t print(const __FlashStringHelper* s) { return print((const char*)s); }
+  size_t print(char c) { return write((const uint8_t*)&c, 1); }
+  size_t print(long n) { char b[16]; snprintf(b, sizeof(b), "%ld", n); return print(b); }
+  size_t print(int n) { return print((long)n); }
+  size_t print(double d, int digits = 2) { char b[32]; snprintf(b, sizeof(b), "%.*f", digits, d); return print(b); }
+
+  size_t println(void) { return print("\r\n"); }
+  template<class T> size_t println(T v) { size_t n = print(v); return n + println(); }
+};
+
+#endif
@@ -0,0 +1,12 @@
+// Host stand-in for the RTL_Stdlib DC motor interface
+#ifndef _HOST_IDCMotor_h_
+#define _HOST_IDCMotor_h_
+
+#include "RTL_Stdlib.h"
+
+class IDCMotor
+{
+    public: enum DCMotorMode { FORWARD = 1, BACKWARD = 2, BRAKE = 3, RELEASE = 4 };
+};
+
+#endif
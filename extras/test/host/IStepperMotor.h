@@ -0,0 +1,13 @@
+// Host stand-in for the RTL_Stdlib stepper motor interface
+#ifndef _HOST_IStepperMotor_h_
+#define _HOST_IStepperMotor_h_
+
+#include "RTL_Stdlib.h"
+
+class IStepperMotor
+{
+    public: enum MotorMode { SINGLE, DOUBLE, INTERLEAVE, MICROSTEP };
+    public: enum MotorDirection { FORWARD = 1, BACKWARD = -1 };
+};
+
+#endif
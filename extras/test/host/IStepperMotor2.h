@@ -0,0 +1,13 @@
+// Host stand-in for the RTL_Stdlib stepper motor interface
+#ifndef _HOST_IStepperMotor2_h_
+#define _HOST_IStepperMotor2_h_
+
+#include "RTL_Stdlib.h"
+
+class IStepperMotor2
+{
+    public: enum MotorMode { SINGLE, DOUBLE, INTERLEAVE, MICROSTEP };
+    public: enum MotorDirection { FORWARD = 1, BACKWARD = -1 };
+};
+
+#endif
@@ -0,0 +1,2 @@
+// Host stand-in for RTL_Math; the library only needs <math.h>
+#include <math.h>
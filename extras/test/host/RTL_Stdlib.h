@@ -0,0 +1,17 @@
+/***************************************************
+  Host stand-in for the parts of RTL_Stdlib the library uses: class names
+  for tracing, and TRACE(), which compiles to nothing.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#ifndef _HOST_RTL_Stdlib_h_
+#define _HOST_RTL_Stdlib_h_
+
+#include "Arduino.h"
+
+#define DECLARE_CLASSNAME static const char* _classname_
+#define DEFINE_CLASSNAME(c) const char* c::_classname_ = #c
+#define TRACE(x)
+
+#endif
@@ -0,0 +1,2 @@
+// Pre-1.0 Arduino header name, used by sources that check ARDUINO >= 100
+#include "Arduino.h"
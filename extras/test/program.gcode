@@ -0,0 +1,15 @@
+; Test program for AF_GCode on the host (see test_gcode.py)
+(XY stage, 10 steps per mm)
+G1 F1200 X10 Y5
+G0 X20
+N7 G1 X20 Y20 F2400*33
+G1.5 X3
+M17.9
+G1 Q5
+G1 X5 Z1
+G0 X-4.5
+G4 P50
+M114
+G0 X4 Y-2
+G4 P0
+M114
@@ -0,0 +1,141 @@
+/***************************************************
+  Stream on the master side of a pseudo-terminal, for running a sketch's
+  serial protocol on the host: a program on the other side opens slave()
+  as it would the board's serial port. Everything written to the stream is
+  also copied to a transcript file, so a test can check the answers.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#ifndef _PTY_STREAM_h_
+#define _PTY_STREAM_h_
+
+#include <Arduino.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+class PtyStream : public Stream {
+ public:
+  PtyStream(void) : _master(-1), _slave(-1), _transcript(NULL), _peek(-1), _hungUp(false) {}
+  ~PtyStream(void) { close(); }
+
+  // Opens the pseudo-terminal, raw, and the transcript file (none if NULL).
+  // Returns false on failure.
+  bool open(const char* transcript)
+  {
+    struct termios raw;
+
+    cfmakeraw(&raw);
+
+    if (openpty(&_master, &_slave, _name, &raw, NULL) < 0) return false;
+
+    // The slave is kept open until the other side has sent something:
+    // until then, reading the master would report a hang-up
+    fcntl(_master, F_SETFL, O_NONBLOCK);
+
+    if (transcript != NULL && (_transcript = fopen(transcript, "w")) == NULL) return false;
+
+    return true;
+  }
+
+  void close(void)
+  {
+    if (_slave >= 0) ::close(_slave);
+    if (_master >= 0) ::close(_master);
+    if (_transcript != NULL) fclose(_transcript);
+
+    _master = _slave = -1;
+    _transcript = NULL;
+  }
+
+  const char* slave(void) { return _name; }
+
+  // The other side has closed the slave
+  bool hungUp(void) { return _hungUp; }
+
+  int available(void)
+  {
+    if (_peek < 0) _peek = next();
+
+    return (_peek >= 0) ? 1 : 0;
+  }
+
+  int read(void)
+  {
+    int c = (_peek >= 0) ? _peek : next();
+
+    _peek = -1;
+
+    return c;
+  }
+
+  size_t write(const uint8_t* data, size_t len)
+  {
+    size_t done = 0;
+
+    while (done < len)
+    {
+      ssize_t n = ::write(_master, data + done, len - done);
+
+      if (n > 0)
+        done += n;
+      else if (n < 0 && errno == EAGAIN)
+        waitFor(POLLOUT);
+      else
+        break;
+    }
+
+    if (_transcript != NULL)
+    {
+      fwrite(data, 1, done, _transcript);
+      fflush(_transcript);
+    }
+
+    return done;
+  }
+
+ private:
+  int _master;
+  int _slave;
+  char _name[64];
+  FILE* _transcript;
+  int _peek;                // Character read ahead by available(), -1 if none
+  bool _hungUp;
+
+  // Reads a character without waiting; -1 if none has come in
+  int next(void)
+  {
+    uint8_t c;
+    ssize_t n = ::read(_master, &c, 1);
+
+    if (n == 1)
+    {
+      // The other side is there: let its close be seen
+      if (_slave >= 0)
+      {
+        ::close(_slave);
+        _slave = -1;
+      }
+
+      return c;
+    }
+
+    if (n < 0 && errno == EIO) _hungUp = true;
+
+    return -1;
+  }
+
+  void waitFor(short events)
+  {
+    struct pollfd p = { _master, events, 0 };
+
+    poll(&p, 1, 100);
+  }
+};
+
+#endif
@@ -0,0 +1,32 @@
+/***************************************************
+  Checks for the host tests. A failed check is reported with its line and
+  the test goes on; TEST_RESULT() ends main() with the count.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#ifndef _TEST_h_
+#define _TEST_h_
+
+#include <stdio.h>
+
+static int _checks = 0;
+static int _failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    _checks++; \
+    if (!(cond)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); _failures++; } \
+  } while (0)
+
+#define CHECK_EQ(a, b) \
+  do { \
+    long _a = (long)(a), _b = (long)(b); \
+    _checks++; \
+    if (_a != _b) { printf("%s:%d: CHECK_EQ(%s, %s) failed: %ld != %ld\n", __FILE__, __LINE__, #a, #b, _a, _b); _failures++; } \
+  } while (0)
+
+#define TEST_RESULT(name) \
+  (printf("%s: %d checks, %d failed\n", name, _checks, _failures), _failures ? 1 : 0)
+
+#endif
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+"""Runs extras/gcode_stream.py against the GCode example built for the host.
+
+    test_gcode.py <gcode_host> <program.gcode>
+
+gcode_host runs AF_GCode on a pseudo-terminal, with the shield on the
+loopback bus. The test checks the answers it sent: an "ok" for every line
+that is run, an "error: " with the reason for every bad line, and the
+positions reported by M114.
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+STREAM = os.path.join(HERE, "..", "gcode_stream.py")
+
+# Lines of program.gcode that are answered with an error, and the reason
+ERRORS = {
+    "G1.5 X3": "bad command",
+    "M17.9": "bad command",
+    "G1 Q5": "bad word",
+    "G1 X5 Z1": "no such axis",
+}
+
+# Positions reported by the M114s, in order
+POSITIONS = [
+    "X:-4.50 Y:20.00",
+    "X:4.00 Y:-2.00",
+]
+
+checks = 0
+failures = 0
+
+
+def check(cond, what):
+    global checks, failures
+    checks += 1
+    if not cond:
+        print("test_gcode: %s failed" % what)
+        failures += 1
+
+
+def main():
+    host, program = sys.argv[1], sys.argv[2]
+
+    with open(program) as f:
+        lines = [line.strip() for line in f if line.strip()]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        transcript = os.path.join(tmp, "transcript")
+        board = subprocess.Popen([host, transcript], stdout=subprocess.PIPE, text=True)
+        port = board.stdout.readline().strip()
+
+        sender = subprocess.run([sys.executable, STREAM, port, program],
+                                capture_output=True, text=True, timeout=60)
+        board.wait(timeout=60)
+
+        with open(transcript) as f:
+            answers = [line.strip() for line in f if line.strip()]
+
+    oks = [a for a in answers if a == "ok"]
+    errors = [a for a in answers if a.startswith("error: ")]
+    reports = [a for a in answers if a != "ok" and not a.startswith("error: ")]
+
+    # Every line is answered once, in order
+    check(len(oks) == len(lines) - len(ERRORS), "%d ok answers" % len(oks))
+    check(errors == ["error: " + ERRORS[l] for l in lines if l in ERRORS], "errors %s" % errors)
+    check(reports == POSITIONS, "M114 %s" % reports)
+
+    # The sender reports the bad lines, with their numbers, and fails
+    check(sender.returncode == 1, "sender exit %d" % sender.returncode)
+    check(sender.stderr.count("error: ") == len(ERRORS), "sender errors")
+    check(sender.stdout.split() == " ".join(POSITIONS).split(), "sender output %r" % sender.stdout)
+    check(board.returncode == 0, "host exit %d" % board.returncode)
+
+    print("test_gcode: %d checks, %d failed" % (checks, failures))
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,198 @@
+/***************************************************
+  Host test of the Linux i2c-dev bus backend: batching into one I2C_RDWR
+  transfer, on the loopback bus, and the errors a transfer reports, on a
+  device that cannot be opened (see Makefile).
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#include <AF_MotorShield.h>
+#include <AF_MotorShieldGroup.h>
+#include "test.h"
+
+
+static void testBatch(void)
+{
+  AF_MS_LinuxI2CBus bus(AF_MS_LINUX_I2C_LOOPBACK);
+  AF_MS_PWMServoDriver pwm(0x60, bus);
+  uint16_t on[16] = { 0 };
+  uint16_t off[16];
+
+  for (uint8_t i = 0; i < 16; i++) off[i] = 100 * (i + 1);
+
+  pwm.begin();
+  CHECK(bus.isLoopback());
+
+  // Outside a batch every transaction is a transfer of its own
+  uint32_t before = bus.transfers();
+
+  CHECK(pwm.setPWM(0, 0, 4096));
+  CHECK_EQ(bus.transfers(), before + 1);
+
+  // A block split into several bursts goes out in one transfer
+  before = bus.transfers();
+  CHECK(pwm.setPWMBlock(0, 16, on, off));
+  CHECK_EQ(bus.transfers(), before + 1);
+
+  for (uint8_t i = 0; i < 16; i++) CHECK_EQ(bus.loopback().channelOff(i), off[i]);
+
+  // So do the writes of several flushes in a batch of the bus
+  before = bus.transfers();
+  bus.beginBatch();
+
+  for (uint8_t i = 0; i < 16; i += 2)
+  {
+    pwm.stagePWM(i, 0, 4000 - i);
+    CHECK(pwm.flush());
+  }
+
+  CHECK_EQ(bus.transfers(), before);
+  CHECK_EQ(bus.endBatch(), AF_MS_BUS_OK);
+  CHECK_EQ(bus.transfers(), before + 1);
+  CHECK_EQ(bus.loopback().channelOff(14), 4000 - 14);
+
+  // A batch with more messages than one transfer takes is sent early
+  before = bus.transfers();
+  bus.beginBatch();
+
+  for (uint8_t i = 0; i < AF_MS_LINUX_I2C_MAX_MSGS + 2; i++)
+  {
+    bus.beginWrite(0x60);
+    bus.write(LED0_OFF_L);
+    bus.write(i);
+    CHECK_EQ(bus.endWrite(), AF_MS_BUS_OK);
+  }
+
+  CHECK_EQ(bus.transfers(), before + 1);
+  CHECK_EQ(bus.endBatch(), AF_MS_BUS_OK);
+  CHECK_EQ(bus.transfers(), before + 2);
+  CHECK_EQ(bus.loopback().reg(LED0_OFF_L), AF_MS_LINUX_I2C_MAX_MSGS + 1);
+}
+
+
+static void testOverflow(void)
+{
+  AF_MS_LinuxI2CBus bus(AF_MS_LINUX_I2C_LOOPBACK);
+
+  bus.begin(100000);
+
+  // A transaction longer than the buffer is dropped, not sent cut short
+  uint32_t before = bus.transfers();
+
+  bus.beginWrite(0x60);
+  bus.write(LED0_ON_L);
+
+  for (uint8_t i = 0; i < AF_MS_I2C_BUFFER_SIZE; i++) bus.write(0x55);
+
+  CHECK_EQ(bus.endWrite(), AF_MS_BUS_TOO_LONG);
+  CHECK_EQ(bus.transfers(), before);
+  CHECK_EQ(bus.loopback().reg(LED0_ON_L), 0);
+
+  // The bus carries on with the next one
+  bus.beginWrite(0x60);
+  bus.write(LED0_ON_L);
+  bus.write(0x12);
+  CHECK_EQ(bus.endWrite(), AF_MS_BUS_OK);
+  CHECK_EQ(bus.loopback().reg(LED0_ON_L), 0x12);
+}
+
+
+static void testErrors(void)
+{
+  AF_MS_LinuxI2CBus bus("/nonexistent/i2c-9");
+  AF_MS_PWMServoDriver pwm(0x60, bus);
+  uint16_t on[4] = { 0 };
+  uint16_t off[4] = { 1, 2, 3, 4 };
+  uint8_t b;
+
+  pwm.begin();
+  CHECK(!bus.isOpen());
+  CHECK(bus.lastError() != 0);
+
+  // Single writes fail, and are retried and counted by the driver
+  pwm.resetStats();
+  CHECK(!pwm.setPWM(0, 0, 100));
+  CHECK_EQ(pwm.getLastError(), AF_MS_BUS_ERROR);
+  CHECK_EQ(pwm.getStats().retries, pwm.getRetryLimit());
+  CHECK_EQ(pwm.getStats().failures, 1);
+  CHECK_EQ(pwm.getStats().errors, 1 + pwm.getRetryLimit());
+  CHECK_EQ(pwm.getStats().timeouts, 0);
+
+  // A failed batch is reported by endBatch()
+  pwm.resetStats();
+  CHECK(!pwm.setPWMBlock(0, 4, on, off));
+  CHECK_EQ(pwm.getStats().failures, 1);
+
+  // So are writes of a batch sent ahead of a read
+  bus.beginBatch();
+  bus.beginWrite(0x60);
+  bus.write(LED0_OFF_L);
+  bus.write(1);
+  CHECK_EQ(bus.endWrite(), AF_MS_BUS_OK);
+  CHECK_EQ(bus.read(0x60, PCA9685_MODE1, &b, 1), 0);
+  CHECK_EQ(bus.endBatch(), AF_MS_BUS_ERROR);
+
+  // And a batch sent early because it filled up
+  bus.beginBatch();
+
+  uint8_t early = AF_MS_BUS_OK;
+
+  for (uint8_t i = 0; i < AF_MS_LINUX_I2C_MAX_MSGS; i++)
+  {
+    bus.beginWrite(0x60);
+    bus.write(LED0_OFF_L);
+    bus.write(i);
+
+    uint8_t status = bus.endWrite();
+
+    if (status != AF_MS_BUS_OK) early = status;
+  }
+
+  CHECK_EQ(early, AF_MS_BUS_ERROR);
+  CHECK_EQ(bus.endBatch(), AF_MS_BUS_ERROR);
+
+  // The next batch starts clean
+  bus.beginBatch();
+  CHECK_EQ(bus.endBatch(), AF_MS_BUS_OK);
+}
+
+
+static void testGroupErrors(void)
+{
+  AF_MS_LinuxI2CBus bus("/nonexistent/i2c-9");
+  AF_MotorShield shield(0x60, bus);
+  AF_MotorShieldGroup group(0x70, 0, bus);
+  AF_DCMotor* motor = shield.GetDCMotor(0);
+
+  shield.Begin();
+  CHECK(group.Add(shield));
+
+  // A failed group write leaves the members' shadows unknown, so their own
+  // writes of the same values still go out
+  CHECK(!group.AllOff());
+
+  uint32_t before = shield.BusStats().transactions;
+
+  motor->Run(AF_DCMotor::RELEASE);
+  CHECK(shield.BusStats().transactions > before);
+
+  group.BeginUpdate();
+  group.SetPin(9, LOW);
+  group.SetPin(10, LOW);
+  CHECK(!group.Commit());
+
+  before = shield.BusStats().transactions;
+  motor->Run(AF_DCMotor::RELEASE);
+  CHECK(shield.BusStats().transactions > before);
+}
+
+
+int main(void)
+{
+  testBatch();
+  testOverflow();
+  testErrors();
+  testGroupErrors();
+
+  return TEST_RESULT("test_linux_bus");
+}
@@ -0,0 +1,414 @@
+/***************************************************
+  Host test of the motion code: the trapezoidal and S-curve ramps of
+  AF_StepperMotion, stops and new targets in the middle of a move, the
+  automatic mode of the steppers, coordinated moves of AF_MultiStepper and
+  the junctions of AF_MotionQueue. Runs on the in-memory AF_MS_RecordingBus,
+  on a simulated clock (see Makefile).
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#include <AF_MotorShield.h>
+#include <AF_MultiStepper.h>
+#include <AF_MotionQueue.h>
+#include "test.h"
+
+
+AF_MS_RecordingBus AF_MS_HostBus;
+
+uint32_t hostMicros = 0;
+uint32_t hostClockTick = 1;
+
+
+// Runs a move of the motion code to its end, on full steps, keeping the step
+// intervals. Returns the number of steps.
+static uint32_t runMove(AF_StepperMotion& motion, uint32_t* intervals, uint32_t size)
+{
+  uint32_t steps = 0;
+  int8_t dir;
+
+  while ((dir = motion.Plan()) != 0 && steps < 100000)
+  {
+    motion.Stepped(dir * motion.Unit());
+
+    if (steps < size) intervals[steps] = motion.Interval();
+
+    steps++;
+  }
+
+  return steps;
+}
+
+
+// Gets the acceleration at step 'i' of a move, in steps per second per second
+static uint32_t acceleration(const uint32_t* intervals, uint32_t i)
+{
+  double v0 = 1e6 / intervals[i];
+  double v1 = 1e6 / intervals[i + 1];
+
+  return (uint32_t)((v1 - v0) * 1e6 / intervals[i]);
+}
+
+
+// Checks that the time between steps 'i' and 'i+1' of a move matches the time
+// between the same steps counted from the end, to within 'percent', for 'i'
+// from 'first' to 'last'
+static bool symmetric(const uint32_t* intervals, uint32_t steps, uint32_t first, uint32_t last, uint32_t percent)
+{
+  for (uint32_t i = first; i <= last; i++)
+  {
+    uint32_t up = intervals[i];
+    uint32_t down = intervals[steps - 2 - i];
+    uint32_t diff = (up > down) ? up - down : down - up;
+
+    if (100 * diff > percent * up) return false;
+  }
+
+  return true;
+}
+
+
+static void testRamp(void)
+{
+  AF_StepperMotion motion;
+  uint32_t intervals[1000];
+
+  motion.SetProfile(AF_POSITION_UNITS, 1000, 2000, 0);
+  motion.MoveTo(600 * AF_POSITION_UNITS);
+
+  uint32_t steps = runMove(motion, intervals, 1000);
+
+  // 600 steps, ramping up for v^2 / 2a = 250 of them to the maximum speed
+  // and back down over as many
+  CHECK_EQ(steps, 600);
+  CHECK_EQ(motion.Position(), 600 * AF_POSITION_UNITS);
+  CHECK(!motion.IsMoving());
+  CHECK(acceleration(intervals, 100) > 1900 && acceleration(intervals, 100) < 2100);
+  CHECK_EQ(intervals[300], 1000);
+  CHECK(symmetric(intervals, steps, 4, 298, 2));
+}
+
+
+static void testStop(void)
+{
+  AF_StepperMotion motion;
+  uint32_t intervals[1000];
+
+  motion.SetProfile(AF_POSITION_UNITS, 1000, 2000, 0);
+  motion.MoveTo(600 * AF_POSITION_UNITS);
+
+  // Stopped on the way up, the motor slows down over as many steps as it
+  // took to speed up, and the stop becomes the target
+  for (uint8_t i = 0; i < 50; i++) motion.Stepped(motion.Plan() * motion.Unit());
+
+  motion.Stop();
+  CHECK(motion.IsMoving());
+  CHECK_EQ(motion.Target(), 100 * AF_POSITION_UNITS);
+
+  uint32_t steps = runMove(motion, intervals, 1000);
+
+  CHECK_EQ(steps, 50);
+  CHECK_EQ(motion.Position(), motion.Target());
+  CHECK(intervals[0] < intervals[steps - 2]);
+
+  // A target behind a moving motor: it stops, and comes back to it
+  motion.MoveTo(0);
+
+  for (uint8_t i = 0; i < 50; i++) motion.Stepped(motion.Plan() * motion.Unit());
+
+  motion.MoveTo(10 * AF_POSITION_UNITS);
+  runMove(motion, intervals, 1000);
+  CHECK_EQ(motion.Position(), 10 * AF_POSITION_UNITS);
+  CHECK(!motion.IsMoving());
+}
+
+
+static void testSCurve(void)
+{
+  AF_StepperMotion motion;
+  uint32_t intervals[1000];
+
+  motion.SetProfile(AF_POSITION_UNITS, 1000, 2000, 20000);
+  motion.MoveTo(800 * AF_POSITION_UNITS);
+
+  uint32_t steps = runMove(motion, intervals, 1000);
+
+  CHECK_EQ(steps, 800);
+  CHECK_EQ(motion.Position(), 800 * AF_POSITION_UNITS);
+  CHECK(!motion.IsMoving());
+  CHECK_EQ(intervals[400], 1000);
+  CHECK(symmetric(intervals, steps, 50, 398, 5));
+
+  // The acceleration builds up to the limit, instead of starting at it
+  CHECK(acceleration(intervals, 1) < 1000);
+  CHECK(acceleration(intervals, 100) > 1900 && acceleration(intervals, 100) < 2100);
+
+  // A short move does not reach the maximum speed, and still ends on target
+  motion.MoveTo(760 * AF_POSITION_UNITS);
+  steps = runMove(motion, intervals, 1000);
+  CHECK_EQ(steps, 40);
+  CHECK_EQ(motion.Position(), 760 * AF_POSITION_UNITS);
+  CHECK(intervals[20] > 1000);
+}
+
+
+static void testRetarget(void)
+{
+  AF_StepperMotion motion;
+  uint32_t intervals[1000];
+
+  motion.SetProfile(AF_POSITION_UNITS, 1000, 2000, 20000);
+
+  // Further on: the cruise gets longer
+  motion.MoveTo(400 * AF_POSITION_UNITS);
+
+  for (uint8_t i = 0; i < 100; i++) motion.Stepped(motion.Plan() * motion.Unit());
+
+  motion.MoveTo(900 * AF_POSITION_UNITS);
+  CHECK_EQ(runMove(motion, intervals, 1000), 800);
+  CHECK_EQ(motion.Position(), 900 * AF_POSITION_UNITS);
+
+  // Closer than the stop: the motor overshoots and comes back
+  motion.MoveTo(0);
+
+  for (uint8_t i = 0; i < 200; i++) motion.Stepped(motion.Plan() * motion.Unit());
+
+  motion.MoveTo(650 * AF_POSITION_UNITS);
+  runMove(motion, intervals, 1000);
+  CHECK_EQ(motion.Position(), 650 * AF_POSITION_UNITS);
+  CHECK(!motion.IsMoving());
+}
+
+
+static void testRescale(void)
+{
+  AF_StepperMotion motion;
+  uint32_t intervals[2000];
+
+  // Half steps from the middle of the ramp on: the speed stays the same, in
+  // steps of half the size
+  motion.SetProfile(AF_POSITION_UNITS, 1000, 2000, 0);
+  motion.MoveTo(600 * AF_POSITION_UNITS);
+
+  for (uint8_t i = 0; i < 100; i++) motion.Stepped(motion.Plan() * motion.Unit());
+
+  uint32_t interval = motion.Interval();
+
+  motion.Rescale(AF_POSITION_UNITS / 2);
+  motion.SetProfile(AF_POSITION_UNITS / 2, 500, 4000, 0);
+  CHECK_EQ(motion.Interval(), interval / 2);
+
+  CHECK_EQ(runMove(motion, intervals, 2000), 1000);
+  CHECK_EQ(motion.Position(), 600 * AF_POSITION_UNITS);
+
+  // And back to full steps on an S-curve
+  motion.MoveTo(0);
+
+  for (uint16_t i = 0; i < 200; i++) motion.Stepped(motion.Plan() * motion.Unit());
+
+  motion.Rescale(AF_POSITION_UNITS);
+  motion.SetProfile(AF_POSITION_UNITS, 1000, 2000, 20000);
+  runMove(motion, intervals, 2000);
+  CHECK_EQ(motion.Position(), 0);
+  CHECK(!motion.IsMoving());
+}
+
+
+static void testAutoShift(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MotorShield shield(0x60, bus);
+
+  shield.Begin();
+
+  AF_StepperMotor* motor = shield.GetStepperMotor(0, 200);
+
+  // Every reading of the clock takes 40 us, and so does a step: micro-steps
+  // are too short for it at the maximum speed of 1000 steps per second
+  hostClockTick = 40;
+
+  motor->MaxSpeed(1000);
+  motor->Acceleration(4000);
+  motor->Mode(AF_StepperMotor::MICROSTEP);
+  motor->AutoMode(true);
+
+  bool shifted = false;
+
+  motor->MoveTo(400 * motor->Microsteps());
+
+  while (motor->Service())
+  {
+    if (motor->Mode() != AF_StepperMotor::MICROSTEP) shifted = true;
+  }
+
+  // The motor went up to coarser steps at speed, and ended in micro-steps on
+  // the target
+  CHECK(shifted);
+  CHECK_EQ(motor->Mode(), AF_StepperMotor::MICROSTEP);
+  CHECK_EQ(motor->Position(), 400 * motor->Microsteps());
+
+  // Stopped at speed, it still ends on a micro-step
+  motor->MoveTo(0);
+
+  for (uint16_t i = 0; i < 2000; i++) motor->Service();
+
+  motor->Stop();
+
+  while (motor->Service());
+
+  CHECK_EQ(motor->Mode(), AF_StepperMotor::MICROSTEP);
+  CHECK_EQ(motor->Position(), motor->TargetPosition());
+  CHECK(motor->Position() > 0);
+
+  hostClockTick = 1;
+}
+
+
+static void testMultiStepper(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MotorShield shield(0x60, bus);
+
+  shield.Begin();
+
+  AF_StepperMotor* x = shield.GetStepperMotor(0, 200);
+  AF_StepperMotor* y = shield.GetStepperMotor(1, 200);
+  AF_MultiStepper xy;
+
+  // Full steps, counted from the coils' new angle
+  x->Mode(AF_StepperMotor::DOUBLE);
+  x->MaxSpeed(1000);
+  x->Acceleration(4000);
+  y->Mode(AF_StepperMotor::DOUBLE);
+  y->MaxSpeed(1000);
+  y->Acceleration(4000);
+  x->Position(0);
+  y->Position(0);
+  CHECK(xy.Add(x));
+  CHECK(xy.Add(y));
+  CHECK(!xy.Add(x));
+
+  // Both motors end on their targets together, the minor axis never more
+  // than a step off the line
+  int32_t target[2] = { 300, -120 };
+  int32_t worst = 0;
+
+  xy.MoveTo(target);
+
+  while (xy.Service())
+  {
+    int32_t off = 5 * y->Position() + 2 * x->Position();
+
+    if (off < 0) off = -off;
+    if (off > worst) worst = off;
+  }
+
+  CHECK_EQ(x->Position(), 300);
+  CHECK_EQ(y->Position(), -120);
+  CHECK(worst <= 5);
+  CHECK(!x->IsRunning() && !y->IsRunning());
+
+  // A stop slows both down along the line
+  int32_t back[2] = { 0, 0 };
+
+  xy.MoveTo(back);
+
+  for (uint16_t i = 0; i < 20000; i++) xy.Service();
+
+  xy.Stop();
+
+  while (xy.Service());
+
+  CHECK(x->Position() > 0 && x->Position() < 300);
+  CHECK(!xy.IsRunning());
+  CHECK(!x->IsRunning() && !y->IsRunning());
+
+  int32_t off = 5 * y->Position() + 2 * x->Position();
+
+  CHECK(off >= -5 && off <= 5);
+}
+
+
+static void testQueue(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MotorShield shield(0x60, bus);
+
+  shield.Begin();
+
+  AF_StepperMotor* x = shield.GetStepperMotor(0, 200);
+  AF_StepperMotor* y = shield.GetStepperMotor(1, 200);
+  AF_MultiStepper xy;
+  AF_MotionQueue path(xy);
+
+  // Full steps, counted from the coils' new angle
+  x->Mode(AF_StepperMotor::DOUBLE);
+  x->MaxSpeed(1000);
+  x->Acceleration(4000);
+  y->Mode(AF_StepperMotor::DOUBLE);
+  y->MaxSpeed(1000);
+  y->Acceleration(4000);
+  x->Position(0);
+  y->Position(0);
+  xy.Add(x);
+  xy.Add(y);
+
+  // Two moves with a shallow corner between them: the motors go through
+  // the junction without stopping
+  int32_t corner[2] = { 300, 0 };
+  int32_t end[2] = { 600, 60 };
+
+  CHECK(path.MoveTo(corner));
+  CHECK(path.MoveTo(end));
+  CHECK_EQ(path.Count(), 2);
+
+  uint32_t last = micros();
+  uint32_t longest = 0;
+  int32_t position = 0;
+
+  while (path.Service())
+  {
+    if (x->Position() != position)
+    {
+      uint32_t now = micros();
+
+      position = x->Position();
+
+      if (position >= 250 && position <= 350 && now - last > longest) longest = now - last;
+
+      last = now;
+    }
+  }
+
+  CHECK(longest < 2000);
+  CHECK_EQ(x->Position(), 600);
+  CHECK_EQ(y->Position(), 60);
+  CHECK_EQ(path.Count(), 0);
+
+  // A reversal is a junction the motors stop at
+  int32_t there[2] = { 700, 60 };
+  int32_t back[2] = { 500, 60 };
+
+  path.MoveTo(there);
+  path.MoveTo(back);
+
+  while (path.Service());
+
+  CHECK_EQ(x->Position(), 500);
+  CHECK_EQ(y->Position(), 60);
+}
+
+
+int main(void)
+{
+  testRamp();
+  testStop();
+  testSCurve();
+  testRetarget();
+  testRescale();
+  testAutoShift();
+  testMultiStepper();
+  testQueue();
+
+  return TEST_RESULT("test_motion");
+}
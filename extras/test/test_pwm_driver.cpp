@@ -0,0 +1,246 @@
+/***************************************************
+  Host test of the bytes the PCA9685 driver and the shield write: the
+  register cache, auto-increment bursts, deferred frames and the MODE2
+  frame-commit setting. Runs on the in-memory AF_MS_RecordingBus (see
+  Makefile).
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#include <AF_MotorShield.h>
+#include "test.h"
+
+
+AF_MS_RecordingBus AF_MS_HostBus;
+
+
+// Checks that the last transaction wrote 'count' channels from 'first' with
+// the given values
+static bool wroteLEDs(AF_MS_RecordingBus& bus, uint8_t first, uint8_t count, const uint16_t* on, const uint16_t* off)
+{
+  const uint8_t* b = bus.last();
+
+  if (bus.lastLength() != 1 + 4*count || b[0] != LED0_ON_L + 4*first) return false;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if ((b[1+4*i] | (b[2+4*i] << 8)) != on[i]) return false;
+    if ((b[3+4*i] | (b[4+4*i] << 8)) != off[i]) return false;
+  }
+
+  return true;
+}
+
+
+static void testCache(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MS_PWMServoDriver pwm(0x40, bus);
+  uint16_t on = 0, off = 2048;
+
+  pwm.begin();
+
+  // The first write of a channel goes out; writing the same value again is
+  // skipped until the shadow is invalidated
+  CHECK(pwm.setPWM(3, on, off));
+  CHECK_EQ(bus.transactions(), 1);
+  CHECK(wroteLEDs(bus, 3, 1, &on, &off));
+  CHECK_EQ(bus.channelOff(3), 2048);
+
+  CHECK(pwm.setPWM(3, on, off));
+  CHECK_EQ(bus.transactions(), 1);
+
+  off = 1024;
+  CHECK(pwm.setPWM(3, on, off));
+  CHECK_EQ(bus.transactions(), 2);
+  CHECK(wroteLEDs(bus, 3, 1, &on, &off));
+
+  pwm.invalidate();
+  CHECK(pwm.setPWM(3, on, off));
+  CHECK_EQ(bus.transactions(), 3);
+}
+
+
+static void testBurst(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MS_PWMServoDriver pwm(0x40, bus);
+  uint16_t on[10] = { 0 };
+  uint16_t off[10] = { 100, 200, 300, 400, 500, 600, 700, 800, 900, 1000 };
+
+  pwm.begin();
+
+  // Consecutive channels go out in one auto-increment write
+  CHECK(pwm.setPWMBlock(0, 4, on, off));
+  CHECK_EQ(bus.transactions(), 1);
+  CHECK(wroteLEDs(bus, 0, 4, on, off));
+
+  // Channels at the ends of a block that the chip already holds are trimmed
+  off[2] = 333;
+  CHECK(pwm.setPWMBlock(0, 4, on, off));
+  CHECK_EQ(bus.transactions(), 2);
+  CHECK(wroteLEDs(bus, 2, 1, &on[2], &off[2]));
+
+  // A block longer than the transmit buffer is split at PCA9685_MAX_BURST
+  pwm.invalidate();
+  CHECK(pwm.setPWMBlock(4, 10, on, off));
+  CHECK_EQ(bus.transactions(), 2 + (10 + PCA9685_MAX_BURST - 1) / PCA9685_MAX_BURST);
+
+  for (uint8_t i = 0; i < 10; i++) CHECK_EQ(bus.channelOff(4 + i), off[i]);
+
+  // Blocks that run past channel 15 are rejected without a write
+  uint32_t before = bus.transactions();
+
+  CHECK(!pwm.setPWMBlock(12, 5, on, off));
+  CHECK(!pwm.setPWMBlock(16, 1, on, off));
+  CHECK_EQ(bus.transactions(), before);
+}
+
+
+static void testFrame(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MS_PWMServoDriver pwm(0x40, bus);
+  uint16_t on[6] = { 0 };
+  uint16_t off[6] = { 4096, 1000, 4096, 2000, 4096, 3000 };
+  uint16_t zero[6] = { 0 };
+  uint16_t one = 1234;
+
+  pwm.begin();
+  pwm.setPWMBlock(0, 6, zero, zero);    // Known values to run the burst through
+  pwm.setPWMBlock(6, 6, zero, zero);
+
+  uint32_t before = bus.transactions();
+
+  // Channel 0 and a frame on 2-7: a burst from channel 0 would have to stop
+  // at channel 6 and cut the frame, so the frame goes out whole on its own
+  pwm.stagePWM(0, 0, one);
+  pwm.stageFrame(2, 6, on, off);
+  CHECK(pwm.isDirty());
+  CHECK(pwm.flush());
+  CHECK(!pwm.isDirty());
+  CHECK_EQ(bus.transactions(), before + 2);
+  CHECK(wroteLEDs(bus, 2, 6, on, off));
+  CHECK_EQ(bus.channelOff(0), one);
+}
+
+
+static void testShield(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MotorShield shield(0x60, bus);
+
+  // A cold start wakes the oscillator, programs MODE2 for frame commits and
+  // turns every output off through ALL_LED
+  shield.Begin();
+  CHECK(!shield.WarmStart());
+  CHECK_EQ(bus.reg(PCA9685_MODE1) & PCA9685_MODE1_SLEEP, 0);
+  CHECK(bus.reg(PCA9685_MODE1) & PCA9685_MODE1_AI);
+  CHECK_EQ(bus.reg(PCA9685_MODE2), PCA9685_MODE2_OUTDRV);
+
+  for (uint8_t num = 0; num < 16; num++) CHECK_EQ(bus.channelOff(num), 4096);
+
+  shield.FrameCommit(false);
+  CHECK_EQ(bus.reg(PCA9685_MODE2), PCA9685_MODE2_OUTDRV | PCA9685_MODE2_OCH);
+  shield.FrameCommit(true);
+
+  // A stepper step writes its six coil channels in one transaction
+  AF_StepperMotor* motor = shield.GetStepperMotor(0, 200);
+  uint32_t before = bus.transactions();
+
+  motor->OneStep(AF_StepperMotor::FORWARD);
+  CHECK_EQ(bus.transactions(), before + 1);
+  CHECK_EQ(bus.last()[0], LED0_ON_L + 4*8);
+  CHECK_EQ(bus.lastLength(), 1 + 4*6);
+
+  // A second Begin() finds the board running and keeps its outputs
+  uint16_t coil = bus.channelOff(8);
+
+  shield.Begin();
+  CHECK(shield.WarmStart());
+  CHECK_EQ(bus.channelOff(8), coil);
+
+  // AllOff() is one ALL_LED write
+  before = bus.transactions();
+  CHECK(shield.AllOff());
+  CHECK_EQ(bus.transactions(), before + 1);
+  CHECK_EQ(bus.last()[0], ALLLED_ON_L);
+
+  for (uint8_t num = 0; num < 16; num++) CHECK_EQ(bus.channelOff(num), 4096);
+
+  // The DC motors know they are released
+  AF_DCMotor* dc = shield.GetDCMotor(0);
+
+  CHECK_EQ(dc->Mode(), AF_DCMotor::RELEASE);
+  dc->Run(AF_DCMotor::FORWARD);
+  CHECK_EQ(dc->Mode(), AF_DCMotor::FORWARD);
+  CHECK(shield.AllOff());
+  CHECK_EQ(dc->Mode(), AF_DCMotor::RELEASE);
+
+  // An emergency stop also drops the stepper's target
+  motor->MoveTo(100);
+  CHECK(motor->DistanceToGo() != 0);
+  CHECK(shield.EmergencyStop());
+  CHECK_EQ(motor->DistanceToGo(), 0);
+  CHECK_EQ(motor->Position(), 1);
+}
+
+
+static void testModes(void)
+{
+  AF_MS_RecordingBus bus;
+  AF_MotorShield shield(0x60, bus);
+
+  shield.Begin();
+
+  AF_StepperMotor* motor = shield.GetStepperMotor(1, 200);
+
+  // No maximum speed until one is set, and a speed of 0 is not one
+  CHECK_EQ(motor->MaxSpeed(), 0);
+  motor->MaxSpeed(0);
+  CHECK_EQ(motor->MaxSpeed(), 0);
+  motor->MaxSpeed(500);
+  motor->MaxSpeed(0);
+  CHECK_EQ(motor->MaxSpeed(), 500);
+
+  // A change of mode keeps the position, in steps of the new mode
+  motor->Mode(AF_StepperMotor::DOUBLE);
+  motor->Position(0);
+
+  for (uint8_t i = 0; i < 3; i++) motor->OneStep(AF_StepperMotor::FORWARD);
+
+  motor->Mode(AF_StepperMotor::INTERLEAVE);
+  CHECK_EQ(motor->Position(), 6);
+  motor->Mode(AF_StepperMotor::MICROSTEP);
+  CHECK_EQ(motor->Position(), 3 * motor->Microsteps());
+
+  // Off a half-step angle, the coils go to a step of the coarser mode and the
+  // position goes with them
+  motor->OneStep(AF_StepperMotor::FORWARD);
+  motor->Mode(AF_StepperMotor::INTERLEAVE);
+  CHECK_EQ(motor->Position(), 6);
+  motor->Mode(AF_StepperMotor::DOUBLE);
+  CHECK_EQ(motor->Position(), 3);
+
+  // So does a coarser micro-step resolution
+  motor->Mode(AF_StepperMotor::MICROSTEP);
+  CHECK(motor->Microsteps(64));
+
+  int32_t position = motor->Position();
+
+  motor->OneStep(AF_StepperMotor::FORWARD);
+  CHECK(motor->Microsteps(8));
+  CHECK_EQ(motor->Position(), position / 8);
+}
+
+
+int main(void)
+{
+  testCache();
+  testBurst();
+  testFrame();
+  testShield();
+  testModes();
+
+  return TEST_RESULT("test_pwm_driver");
+}
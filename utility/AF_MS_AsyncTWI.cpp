@@ -0,0 +1,339 @@
+/***************************************************
+  Interrupt-driven I2C (TWI) write queue for the AF_MS_PWMServoDriver.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#include "AF_MS_I2CBus.h"
+
+#if AF_MS_ASYNC_I2C
+
+#include <avr/interrupt.h>
+#include <util/twi.h>
+
+
+// TWCR values
+#define TWCR_IDLE     (_BV(TWEN))
+#define TWCR_NEXT     (_BV(TWEN) | _BV(TWIE) | _BV(TWINT))
+#define TWCR_START    (_BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWSTA))
+#define TWCR_RESTART  (_BV(TWEN) | _BV(TWIE) | _BV(TWINT) | _BV(TWSTO) | _BV(TWSTA))
+#define TWCR_STOP     (_BV(TWEN) | _BV(TWINT) | _BV(TWSTO))
+
+// The ring holds transactions as [length][address][data...]. Writers move
+// _head, one at a time (see _writing), and the TWI interrupt only moves _tail.
+static uint8_t _ring[AF_MS_ASYNC_RING_SIZE];
+static volatile uint8_t _head;
+static volatile uint8_t _tail;
+static volatile uint8_t _remaining;     // Data bytes left in the transaction on the wire
+static volatile bool    _busy;          // The interrupt owns the bus
+static volatile bool    _started;       // The interrupt has taken the transaction at _tail
+static volatile uint16_t _errors;
+static volatile bool    _writing;       // A tryWrite() is filling the ring
+static void (* volatile _onSent)(void); // See onSent()
+
+
+static inline uint8_t next(uint8_t i)
+{
+  return (i + 1 == AF_MS_ASYNC_RING_SIZE) ? 0 : i + 1;
+}
+
+
+static inline uint8_t used(void)
+{
+  int16_t n = (int16_t)_head - (int16_t)_tail;
+
+  return (n < 0) ? n + AF_MS_ASYNC_RING_SIZE : n;
+}
+
+
+// Sends a STOP and, if more transactions are queued, a new START right after it
+static inline void endTransaction(void)
+{
+  _started = false;
+
+  if (_head != _tail)
+  {
+    TWCR = TWCR_RESTART;
+  }
+  else
+  {
+    TWCR = TWCR_STOP;
+    _busy = false;
+  }
+}
+
+
+ISR(TWI_vect)
+{
+  switch (TW_STATUS)
+  {
+    case TW_START:
+    case TW_REP_START:
+      _remaining = _ring[_tail];  _tail = next(_tail);
+      TWDR = _ring[_tail] << 1;   _tail = next(_tail);    // SLA+W
+      _started = true;
+      TWCR = TWCR_NEXT;
+      break;
+
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (_remaining > 0)
+      {
+        TWDR = _ring[_tail];  _tail = next(_tail);
+        _remaining--;
+        TWCR = TWCR_NEXT;
+      }
+      else
+      {
+        endTransaction();
+
+        if (_onSent != NULL) _onSent();
+      }
+      break;
+
+    default:
+      // NACK, lost arbitration or bus error: drop the rest of this transaction
+      while (_remaining > 0)
+      {
+        _tail = next(_tail);
+        _remaining--;
+      }
+
+      _errors++;
+      endTransaction();
+      break;
+  }
+}
+
+
+AF_MS_AsyncTWIBus AF_MS_AsyncBus;
+
+
+uint32_t AF_MS_AsyncTWI::begin(uint32_t clock)
+{
+  _head = _tail = 0;
+  _remaining = 0;
+  _busy = false;
+  _started = false;
+
+  // Enable the internal pull-ups, as the Wire library does
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+
+  uint32_t twbr = (F_CPU / clock > 16) ? ((F_CPU / clock) - 16) / 2 : 0;
+
+  TWSR = 0;                                   // Prescaler 1
+  TWBR = (twbr > 255) ? 255 : twbr;
+  TWCR = TWCR_IDLE;
+
+  return F_CPU / (16 + 2UL * TWBR);
+}
+
+
+bool AF_MS_AsyncTWI::tryWrite(uint8_t addr, const uint8_t* data, uint8_t len)
+{
+  // Claim the ring. A writer running in an interrupt (AF_StepEngine) that
+  // finds it claimed by the foreground gets false, and tries again later.
+  uint8_t sreg = SREG;
+
+  cli();
+
+  if (_writing || space() < len + 2)
+  {
+    SREG = sreg;
+    return false;
+  }
+
+  _writing = true;
+  SREG = sreg;
+
+  uint8_t head = _head;
+
+  _ring[head] = len;   head = next(head);
+  _ring[head] = addr;  head = next(head);
+
+  for (uint8_t i = 0; i < len; i++)
+  {
+    _ring[head] = data[i];
+    head = next(head);
+  }
+
+  // Publish the transaction and start the bus if the interrupt is not running
+  cli();
+  _head = head;
+  _writing = false;
+
+  if (!_busy)
+  {
+    _busy = true;
+    TWCR = TWCR_START;
+  }
+
+  SREG = sreg;
+
+  return true;
+}
+
+
+void AF_MS_AsyncTWI::write(uint8_t addr, const uint8_t* data, uint8_t len)
+{
+  while (!tryWrite(addr, data, len));
+}
+
+
+bool AF_MS_AsyncTWI::idle(void)
+{
+  return !_busy;
+}
+
+
+void AF_MS_AsyncTWI::flush(void)
+{
+  while (_busy);
+
+  while (TWCR & _BV(TWSTO));    // Let the final STOP finish
+}
+
+
+uint8_t AF_MS_AsyncTWI::space(void)
+{
+  return AF_MS_ASYNC_RING_SIZE - 1 - used();
+}
+
+
+void AF_MS_AsyncTWI::discard(void)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+
+  if (_busy)
+  {
+    // Keep the rest of the transaction the interrupt is sending, or the whole
+    // one whose START is under way, and drop everything after it
+    uint8_t end = _tail;
+    uint8_t n = _started ? _remaining : _ring[_tail] + 2;
+
+    while (n-- > 0) end = next(end);
+
+    _head = end;
+  }
+
+  SREG = sreg;
+}
+
+
+uint16_t AF_MS_AsyncTWI::errors(void)
+{
+  uint8_t sreg = SREG;
+
+  cli();
+
+  uint16_t n = _errors;
+
+  SREG = sreg;
+
+  return n;
+}
+
+
+void AF_MS_AsyncTWI::onSent(void (*handler)(void))
+{
+  uint8_t sreg = SREG;
+
+  cli();                // The pointer takes two writes
+  _onSent = handler;
+  SREG = sreg;
+}
+
+
+bool AF_MS_AsyncTWI::recover(void)
+{
+  uint8_t twbr = TWBR;
+
+  TWCR = 0;               // Stops the interrupt and releases the pins
+  _head = _tail = 0;
+  _remaining = 0;
+  _busy = false;
+  _started = false;
+
+  bool ok = AF_MS_ClearBus(SDA, SCL);
+
+  TWSR = 0;
+  TWBR = twbr;
+  TWCR = TWCR_IDLE;
+
+  return ok;
+}
+
+
+// Polled TWI step used by read(); returns false on timeout
+static bool step(uint8_t twcr)
+{
+  uint16_t timeout = 0xFFFF;
+
+  TWCR = twcr;
+
+  while (!(TWCR & _BV(TWINT)))
+  {
+    if (--timeout == 0) return false;
+  }
+
+  return true;
+}
+
+
+uint8_t AF_MS_AsyncTWI::read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+  const uint8_t go = _BV(TWEN) | _BV(TWINT);
+  uint8_t n = 0;
+
+  // Wait for the queue to drain, and claim the ring so that an interrupt
+  // writer cannot start the bus in the middle of the read
+  for (;;)
+  {
+    flush();
+    cli();
+
+    if (!_busy) break;
+
+    sei();
+  }
+
+  _writing = true;
+  sei();
+
+  // The bus is idle and TWIE is off, so the transfer is done by polling
+  if (!step(go | _BV(TWSTA)) || TW_STATUS != TW_START) goto done;
+
+  TWDR = addr << 1;
+  if (!step(go) || TW_STATUS != TW_MT_SLA_ACK) goto done;
+
+  TWDR = reg;
+  if (!step(go) || TW_STATUS != TW_MT_DATA_ACK) goto done;
+
+  if (!step(go | _BV(TWSTA)) || TW_STATUS != TW_REP_START) goto done;
+
+  TWDR = (addr << 1) | 1;
+  if (!step(go) || TW_STATUS != TW_MR_SLA_ACK) goto done;
+
+  for (n = 0; n < len; n++)
+  {
+    // Acknowledge every byte except the last one
+    if (!step((n + 1 < len) ? (go | _BV(TWEA)) : go)) break;
+
+    buf[n] = TWDR;
+  }
+
+done:
+  TWCR = TWCR_STOP;
+  while (TWCR & _BV(TWSTO));
+
+  if (n < len) _errors++;
+
+  _writing = false;
+
+  return n;
+}
+
+#endif
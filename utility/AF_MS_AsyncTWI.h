@@ -0,0 +1,107 @@
+/***************************************************
+  Interrupt-driven I2C (TWI) write queue for the AF_MS_PWMServoDriver.
+
+  Register writes are copied into a fixed-size ring and clocked out by the
+  TWI interrupt, so the caller can go on computing while the previous
+  transaction is still on the wire. Reads are rare (initialization only) and
+  are done synchronously once the queue has drained.
+
+  Only available on AVR, and only compiled when AF_MS_ASYNC_I2C is set to 1
+  in AF_MS_I2CBus.h, because it takes over the TWI interrupt from the Wire
+  library. AF_MS_AsyncTWIBus is the bus backend built on it; this header is
+  included by AF_MS_I2CBus.h.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#ifndef _AF_MS_AsyncTWI_H
+#define _AF_MS_AsyncTWI_H
+
+#if AF_MS_ASYNC_I2C
+
+#if !defined(__AVR__)
+ #error "AF_MS_ASYNC_I2C requires an AVR TWI peripheral"
+#endif
+
+// Size of the transmit ring in bytes. Each queued transaction takes its data
+// plus 2 bytes (length and address). The default holds three 6-channel
+// stepper coil frames.
+#ifndef AF_MS_ASYNC_RING_SIZE
+#define AF_MS_ASYNC_RING_SIZE 96
+#endif
+
+
+class AF_MS_AsyncTWI {
+ public:
+  // Returns the SCL clock actually applied
+  static uint32_t begin(uint32_t clock);
+
+  // Queues a write transaction. If the ring is full, write() waits for the
+  // interrupt to drain it (back-pressure); tryWrite() returns false instead,
+  // which makes it safe to call with interrupts disabled. tryWrite() may also
+  // be called from an interrupt handler: it returns false if it interrupted
+  // another write.
+  static void write(uint8_t addr, const uint8_t* data, uint8_t len);
+  static bool tryWrite(uint8_t addr, const uint8_t* data, uint8_t len);
+
+  // Waits for the queue to drain, then reads len bytes starting at register
+  // reg. Returns the number of bytes read (0 on a bus error).
+  static uint8_t read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len);
+
+  // Completion: idle() is true when everything queued has been sent;
+  // flush() waits until it is. space() is the free room in the ring.
+  static bool idle(void);
+  static void flush(void);
+  static uint8_t space(void);
+
+  // Drops the transactions still waiting in the ring. The one on the wire is
+  // finished, so the chip never sees a cut-off write.
+  static void discard(void);
+
+  // Number of transactions dropped because the slave did not acknowledge.
+  static uint16_t errors(void);
+
+  // Sets a function the TWI interrupt calls each time a transaction has been
+  // acknowledged to the end and its STOP sent, which is when the PCA9685
+  // latches the outputs: to time the coil writes of a stepper as the motor
+  // sees them, for instance. It runs with interrupts disabled, so it must be
+  // short. NULL removes it.
+  static void onSent(void (*handler)(void));
+
+  // Drops everything queued and clears a stuck bus (see AF_MS_ClearBus())
+  static bool recover(void);
+};
+
+
+// Bus backend (see AF_MS_I2CBus.h). Transactions are assembled in _frame and
+// handed to the queue as a whole by endWrite().
+class AF_MS_AsyncTWIBus {
+ public:
+  void begin(uint32_t clock) { _clock = AF_MS_AsyncTWI::begin(clock); }
+  uint32_t clock(void) { return _clock; }
+
+  void beginWrite(uint8_t addr) { _addr = addr; _len = 0; }
+  void write(uint8_t d) { if (_len < sizeof(_frame)) _frame[_len++] = d; }
+  // Errors happen after endWrite() returns; they are counted by errors()
+  uint8_t endWrite(void) { AF_MS_AsyncTWI::write(_addr, _frame, _len); return AF_MS_BUS_OK; }
+  uint8_t read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len) { return AF_MS_AsyncTWI::read(addr, reg, buf, len); }
+
+  bool idle(void) { return AF_MS_AsyncTWI::idle(); }
+  void flush(void) { AF_MS_AsyncTWI::flush(); }
+  void discard(void) { AF_MS_AsyncTWI::discard(); }
+  void delayMicroseconds(uint16_t us) { ::delayMicroseconds(us); }
+  void beginBatch(void) {}
+  uint8_t endBatch(void) { return AF_MS_BUS_OK; }
+  bool recover(void) { return AF_MS_AsyncTWI::recover(); }
+
+ private:
+  uint32_t _clock;
+  uint8_t _addr;
+  uint8_t _len;
+  uint8_t _frame[AF_MS_I2C_BUFFER_SIZE];
+};
+
+extern AF_MS_AsyncTWIBus AF_MS_AsyncBus;
+
+#endif
+#endif
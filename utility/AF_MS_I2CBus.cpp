@@ -0,0 +1,199 @@
+/***************************************************
+  I2C bus backends for the AF_MS_PWMServoDriver.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#include "AF_MS_I2CBus.h"
+
+
+/*******************************************************************************
+    In-memory recording bus
+*******************************************************************************/
+
+void AF_MS_RecordingBus::reset(void)
+{
+  for (uint16_t r = 0; r < sizeof(_regs); r++) _regs[r] = 0;
+
+  // Power-on state of the PCA9685: asleep, ALLCALL on, all outputs full off
+  _regs[0x00] = 0x11;
+  _regs[0x01] = 0x04;
+  _regs[0x02] = 0xE2;
+  _regs[0x03] = 0xE4;
+  _regs[0x04] = 0xE8;
+  _regs[0x05] = 0xE0;
+  _regs[0xFE] = 0x1E;
+
+  for (uint8_t num = 0; num < 16; num++) _regs[9+4*num] = 0x10;
+
+  _clock = 0;
+  _addr = 0;
+  _len = 0;
+  _transactions = 0;
+  _bytes = 0;
+  _elapsed = 0;
+}
+
+
+void AF_MS_RecordingBus::store(uint8_t r, uint8_t d)
+{
+  if (r >= 0xFA && r <= 0xFD)
+  {
+    // The ALL_LED registers write the same byte of every channel
+    for (uint8_t num = 0; num < 16; num++) _regs[6 + 4*num + (r - 0xFA)] = d;
+  }
+  else if (r == 0x00)
+  {
+    // Writing 1 to RESTART clears it; it is never stored as 1
+    _regs[r] = d & 0x7F;
+  }
+  else
+  {
+    _regs[r] = d;
+  }
+}
+
+
+uint8_t AF_MS_RecordingBus::endWrite(void)
+{
+  _transactions++;
+  _bytes += _len + 1;       // Data plus the address byte
+
+  if (_len == 0) return 0;
+
+  // First byte selects the register; with auto-increment the rest follow it
+  uint8_t r = _log[0];
+
+  for (uint8_t i = 1; i < _len; i++) store(r++, _log[i]);
+
+  return 0;
+}
+
+
+uint8_t AF_MS_RecordingBus::read(uint8_t, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+  _transactions += 2;       // Register select, then the read itself
+  _bytes += 2 + 1 + len;
+
+  for (uint8_t i = 0; i < len; i++) buf[i] = _regs[(uint8_t)(reg + i)];
+
+  return len;
+}
+
+
+#if !defined(ARDUINO) && !defined(__linux__)
+AF_MS_RecordingBus AF_MS_HostBus;
+#endif
+
+
+/*******************************************************************************
+    Bus recovery
+*******************************************************************************/
+
+#if defined(ARDUINO)
+
+#if !defined(INPUT_PULLUP)
+#define INPUT_PULLUP INPUT      // Before Arduino 1.0.1 the pull-ups are not used
+#endif
+
+bool AF_MS_ClearBus(uint8_t sda, uint8_t scl)
+{
+  pinMode(sda, INPUT_PULLUP);
+  pinMode(scl, INPUT_PULLUP);
+  delayMicroseconds(10);
+
+  // Up to 9 clocks finish any byte a slave is still sending
+  for (uint8_t i = 0; i < 9 && digitalRead(sda) == LOW; i++)
+  {
+    pinMode(scl, OUTPUT);
+    digitalWrite(scl, LOW);
+    delayMicroseconds(10);
+    pinMode(scl, INPUT_PULLUP);
+    delayMicroseconds(10);
+  }
+
+  // STOP: SDA rises while SCL is high
+  pinMode(sda, OUTPUT);
+  digitalWrite(sda, LOW);
+  delayMicroseconds(10);
+  pinMode(sda, INPUT_PULLUP);
+  delayMicroseconds(10);
+
+  return digitalRead(sda) == HIGH && digitalRead(scl) == HIGH;
+}
+
+#endif
+
+
+/*******************************************************************************
+    Arduino Wire bus
+*******************************************************************************/
+
+#if defined(ARDUINO) && !AF_MS_ASYNC_I2C
+
+void AF_MS_WireBus::begin(uint32_t clock)
+{
+  _request = clock;
+  _wire->begin();
+
+#if ARDUINO >= 157
+  _wire->setClock(clock);
+#endif
+
+#if defined(TWBR) && defined(TWSR)
+  // AVR: report the clock the TWI bit-rate generator really produces, which
+  // differs from the request because of integer rounding of TWBR.
+  _clock = F_CPU / (16 + 2UL * TWBR * (1 << (2 * (TWSR & 0x03))));
+#elif ARDUINO >= 157
+  _clock = clock;
+#else
+  _clock = 100000;
+#endif
+}
+
+
+uint8_t AF_MS_WireBus::read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+  beginWrite(addr);
+  write(reg);
+  endWrite();
+
+  uint8_t n = _wire->requestFrom(addr, len);
+
+  for (uint8_t i = 0; i < n; i++)
+#if ARDUINO >= 100
+    buf[i] = _wire->read();
+#else
+    buf[i] = _wire->receive();
+#endif
+
+  return n;
+}
+
+
+bool AF_MS_WireBus::recover(void)
+{
+#if defined(TWCR)
+  TWCR = 0;               // Take the pins away from the TWI peripheral
+#endif
+
+  bool ok = AF_MS_ClearBus(_sda, _scl);
+
+  begin(_request);
+
+  return ok;
+}
+
+
+#if !defined(PIN_WIRE_SDA)
+#define PIN_WIRE_SDA SDA
+#define PIN_WIRE_SCL SCL
+#endif
+
+AF_MS_WireBus AF_MS_Wire(Wire, PIN_WIRE_SDA, PIN_WIRE_SCL);
+
+#if defined(WIRE_INTERFACES_COUNT) && (WIRE_INTERFACES_COUNT > 1)
+AF_MS_WireBus AF_MS_Wire1(Wire1, PIN_WIRE1_SDA, PIN_WIRE1_SCL);
+#endif
+
+#endif
@@ -0,0 +1,228 @@
+/***************************************************
+  I2C bus backends for the AF_MS_PWMServoDriver.
+
+  The driver talks to the bus through a small static interface rather than a
+  virtual base class. Every backend provides the same inline methods:
+
+    void     begin(uint32_t clock);   // Start the bus at the given SCL clock
+    uint32_t clock(void);             // SCL clock actually applied
+    void     beginWrite(uint8_t addr);
+    void     write(uint8_t d);
+    uint8_t  endWrite(void);          // AF_MS_BUS_OK or an error code below
+    uint8_t  read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len);
+    bool     idle(void);              // All writes have left the MCU
+    void     flush(void);             // Wait until idle()
+    void     discard(void);           // Drop writes queued but not yet started
+    void     delayMicroseconds(uint16_t us);
+    void     beginBatch(void);        // Writes until endBatch() may be sent together
+    uint8_t  endBatch(void);          // Status of the writes it sent
+    bool     recover(void);           // Free a stuck bus; true if SDA and SCL are high
+
+  The backend is chosen at compile time through AF_MS_Bus, so the Arduino
+  path compiles down to the same Wire calls as before. To override the
+  default choice, define AF_MS_BUS to a backend class name and
+  AF_MS_DEFAULT_BUS to the instance of it that drivers use by default.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#ifndef _AF_MS_I2CBus_H
+#define _AF_MS_I2CBus_H
+
+// Size of the Wire transmit buffer (32 bytes on AVR). A burst write carries the
+// register address plus 4 bytes per channel, so this limits the number of
+// channels that fit in one transaction.
+#ifndef AF_MS_I2C_BUFFER_SIZE
+#define AF_MS_I2C_BUFFER_SIZE 32
+#endif
+
+// Set to 1 to replace the Wire library with an interrupt-driven write queue
+// (AVR only, see AF_MS_AsyncTWI.h). Register writes then return as soon as
+// they are queued and are clocked out by the TWI interrupt in the background.
+// Wire itself must not be used by the sketch in this configuration, since
+// both want the TWI interrupt.
+#ifndef AF_MS_ASYNC_I2C
+#define AF_MS_ASYNC_I2C 0
+#endif
+
+// Transaction status codes, the same as Wire.endTransmission() returns
+#define AF_MS_BUS_OK 0
+#define AF_MS_BUS_TOO_LONG 1       // Data did not fit in the transmit buffer
+#define AF_MS_BUS_NACK_ADDR 2      // Address not acknowledged
+#define AF_MS_BUS_NACK_DATA 3      // Data not acknowledged
+#define AF_MS_BUS_ERROR 4          // Bus error, e.g. lost arbitration or a stuck line
+#define AF_MS_BUS_TIMEOUT 5
+
+#if defined(ARDUINO)
+ #if ARDUINO >= 100
+  #include "Arduino.h"
+ #else
+  #include "WProgram.h"
+ #endif
+#else
+ #include <stdint.h>
+ #include <stddef.h>
+#endif
+
+
+/*******************************************************************************
+    In-memory recording bus
+
+    Keeps a register file for one PCA9685 (whatever its address) and records
+    the transactions written to it. It has no hardware dependencies, so the
+    driver can be exercised on a host or used as a test double.
+*******************************************************************************/
+
+#ifndef AF_MS_RECORDING_LOG_SIZE
+#define AF_MS_RECORDING_LOG_SIZE 64    // Bytes of the last transaction kept
+#endif
+
+class AF_MS_RecordingBus {
+ public:
+  AF_MS_RecordingBus(void) { reset(); }
+
+  void begin(uint32_t clock) { _clock = clock; }
+  uint32_t clock(void) { return _clock; }
+
+  void beginWrite(uint8_t addr) { _addr = addr; _len = 0; }
+  void write(uint8_t d) { if (_len < AF_MS_RECORDING_LOG_SIZE) _log[_len++] = d; }
+  uint8_t endWrite(void);
+  uint8_t read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len);
+
+  bool idle(void) { return true; }
+  void flush(void) {}
+  void discard(void) {}
+  void delayMicroseconds(uint16_t us) { _elapsed += us; }
+  void beginBatch(void) {}
+  uint8_t endBatch(void) { return AF_MS_BUS_OK; }
+  bool recover(void) { return true; }
+
+  // Inspection
+  void reset(void);
+  uint8_t reg(uint8_t r) { return _regs[r]; }
+  uint16_t channelOn(uint8_t num) { return _regs[6+4*num] | (_regs[7+4*num] << 8); }
+  uint16_t channelOff(uint8_t num) { return _regs[8+4*num] | (_regs[9+4*num] << 8); }
+  uint32_t transactions(void) { return _transactions; }
+  uint32_t bytes(void) { return _bytes; }
+  uint8_t lastAddress(void) { return _addr; }
+  uint8_t lastLength(void) { return _len; }
+  const uint8_t* last(void) { return _log; }
+  uint32_t elapsed(void) { return _elapsed; }
+
+ private:
+  uint32_t _clock;
+  uint8_t _regs[256];
+  uint8_t _log[AF_MS_RECORDING_LOG_SIZE];
+  uint8_t _addr;
+  uint8_t _len;
+  uint32_t _transactions;
+  uint32_t _bytes;
+  uint32_t _elapsed;
+
+  void store(uint8_t r, uint8_t d);
+};
+
+
+/*******************************************************************************
+    Bus recovery
+
+    A slave reset in the middle of a read can hold SDA low forever. Clocking
+    SCL by hand until it lets go and then sending a STOP frees the bus.
+    Returns true if both lines are high afterwards. The pins are left as
+    inputs with pull-ups; the caller hands them back to the TWI peripheral.
+*******************************************************************************/
+
+#if defined(ARDUINO)
+bool AF_MS_ClearBus(uint8_t sda, uint8_t scl);
+#endif
+
+
+/*******************************************************************************
+    Arduino Wire bus
+
+    Wraps a TwoWire instance. AF_MS_Wire is the default; boards with a second
+    TWI peripheral also get AF_MS_Wire1.
+*******************************************************************************/
+
+#if defined(ARDUINO) && !AF_MS_ASYNC_I2C
+
+#include <Wire.h>
+
+class AF_MS_WireBus {
+ public:
+  // sda and scl are the pins of the bus, used by recover()
+  AF_MS_WireBus(TwoWire& wire, uint8_t sda, uint8_t scl) : _wire(&wire), _sda(sda), _scl(scl), _request(100000), _clock(100000) {}
+
+  void begin(uint32_t clock);
+  uint32_t clock(void) { return _clock; }
+
+#if ARDUINO >= 100
+  void beginWrite(uint8_t addr) { _wire->beginTransmission(addr); }
+  void write(uint8_t d) { _wire->write(d); }
+#else
+  void beginWrite(uint8_t addr) { _wire->beginTransmission(addr); }
+  void write(uint8_t d) { _wire->send(d); }
+#endif
+  uint8_t endWrite(void) { return _wire->endTransmission(); }
+  uint8_t read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len);
+
+  // Wire transactions complete before endTransmission() returns
+  bool idle(void) { return true; }
+  void flush(void) {}
+  void discard(void) {}
+  void delayMicroseconds(uint16_t us) { ::delayMicroseconds(us); }
+  void beginBatch(void) {}
+  uint8_t endBatch(void) { return AF_MS_BUS_OK; }
+  bool recover(void);
+
+ private:
+  TwoWire* _wire;
+  uint8_t _sda;
+  uint8_t _scl;
+  uint32_t _request;    // Clock asked for in begin()
+  uint32_t _clock;
+};
+
+extern AF_MS_WireBus AF_MS_Wire;
+
+#if defined(WIRE_INTERFACES_COUNT) && (WIRE_INTERFACES_COUNT > 1)
+extern AF_MS_WireBus AF_MS_Wire1;
+#endif
+
+#endif
+
+
+/*******************************************************************************
+    Backend selection
+*******************************************************************************/
+
+#if AF_MS_ASYNC_I2C
+ #include "AF_MS_AsyncTWI.h"
+#elif defined(__linux__) && !defined(ARDUINO)
+ #include "AF_MS_LinuxI2CBus.h"
+#endif
+
+#if !defined(AF_MS_BUS)
+ #if AF_MS_ASYNC_I2C
+  #define AF_MS_BUS AF_MS_AsyncTWIBus
+  #define AF_MS_DEFAULT_BUS AF_MS_AsyncBus
+ #elif defined(ARDUINO) && defined(ARDUINO_SAM_DUE)
+  #define AF_MS_BUS AF_MS_WireBus
+  #define AF_MS_DEFAULT_BUS AF_MS_Wire1     // The shield header is wired to the Due's second bus
+ #elif defined(ARDUINO)
+  #define AF_MS_BUS AF_MS_WireBus
+  #define AF_MS_DEFAULT_BUS AF_MS_Wire
+ #elif defined(__linux__)
+  #define AF_MS_BUS AF_MS_LinuxI2CBus
+  #define AF_MS_DEFAULT_BUS AF_MS_LinuxBus
+ #else
+  #define AF_MS_BUS AF_MS_RecordingBus
+  #define AF_MS_DEFAULT_BUS AF_MS_HostBus
+ #endif
+#endif
+
+typedef AF_MS_BUS AF_MS_Bus;
+
+extern AF_MS_Bus AF_MS_DEFAULT_BUS;
+
+#endif
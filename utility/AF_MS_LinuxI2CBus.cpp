@@ -0,0 +1,259 @@
+/***************************************************
+  Linux i2c-dev bus backend for the AF_MS_PWMServoDriver.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#include "AF_MS_I2CBus.h"
+
+#if defined(__linux__) && !defined(ARDUINO) && !AF_MS_ASYNC_I2C
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+
+AF_MS_LinuxI2CBus AF_MS_LinuxBus(AF_MS_LINUX_I2C_DEVICE);
+
+
+AF_MS_LinuxI2CBus::AF_MS_LinuxI2CBus(const char* device)
+{
+  _device = device;
+  _fd = -1;
+  _error = 0;
+  _clock = 100000;
+  _transfers = 0;
+  _batchDepth = 0;
+  _count = 0;
+  _used = 0;
+  _overflow = false;
+  _batchStatus = AF_MS_BUS_OK;
+}
+
+
+AF_MS_LinuxI2CBus::~AF_MS_LinuxI2CBus(void)
+{
+  submit();
+
+  if (_fd >= 0) close(_fd);
+}
+
+
+void AF_MS_LinuxI2CBus::begin(uint32_t clock)
+{
+  if (isLoopback())
+  {
+    _loopback.begin(clock);
+    _clock = clock;
+    return;
+  }
+
+  if (_fd < 0)
+  {
+    _fd = open(_device, O_RDWR);
+
+    if (_fd < 0)
+    {
+      _error = errno;
+      return;
+    }
+  }
+
+  // The adapter clock comes from the device tree, as a big-endian cell
+  int bus = -1;
+  const char* name = strrchr(_device, '-');
+
+  if (name != NULL) sscanf(name + 1, "%d", &bus);
+
+  if (bus >= 0)
+  {
+    char path[64];
+    uint8_t b[4];
+
+    snprintf(path, sizeof(path), "/sys/class/i2c-adapter/i2c-%d/of_node/clock-frequency", bus);
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd >= 0)
+    {
+      if (::read(fd, b, sizeof(b)) == sizeof(b))
+        _clock = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+
+      close(fd);
+    }
+  }
+}
+
+
+void AF_MS_LinuxI2CBus::beginWrite(uint8_t addr)
+{
+  struct i2c_msg* msg = &_msgs[_count];
+
+  msg->addr = addr;
+  msg->flags = 0;
+  msg->len = 0;
+  msg->buf = &_data[_used];
+  _overflow = false;
+}
+
+
+void AF_MS_LinuxI2CBus::write(uint8_t d)
+{
+  struct i2c_msg* msg = &_msgs[_count];
+
+  // Same limit as the Wire buffer. The transaction is not sent cut short:
+  // endWrite() drops it and returns AF_MS_BUS_TOO_LONG, as Wire does.
+  if (msg->len >= AF_MS_I2C_BUFFER_SIZE)
+  {
+    _overflow = true;
+    return;
+  }
+
+  _data[_used++] = d;
+  msg->len++;
+}
+
+
+uint8_t AF_MS_LinuxI2CBus::endWrite(void)
+{
+  if (_overflow)
+  {
+    _used -= _msgs[_count].len;
+    _overflow = false;
+
+    return AF_MS_BUS_TOO_LONG;
+  }
+
+  _count++;
+
+  // In a batch, send it early if another full-size transaction might not
+  // fit. The batch has then lost whatever that transfer carried if it
+  // failed, which endBatch() reports as well.
+  if (_batchDepth > 0 && _count < AF_MS_LINUX_I2C_MAX_MSGS && _used + AF_MS_I2C_BUFFER_SIZE <= AF_MS_LINUX_I2C_BATCH_SIZE)
+    return AF_MS_BUS_OK;
+
+  return submit();
+}
+
+
+uint8_t AF_MS_LinuxI2CBus::endBatch(void)
+{
+  if (_batchDepth == 0 || --_batchDepth > 0) return AF_MS_BUS_OK;
+
+  uint8_t status = submit();
+
+  if (_batchStatus != AF_MS_BUS_OK) status = _batchStatus;
+
+  _batchStatus = AF_MS_BUS_OK;
+
+  return status;
+}
+
+
+uint8_t AF_MS_LinuxI2CBus::read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len)
+{
+  // Writes queued before the read must reach the chip first. They belong to
+  // a batch, whose endBatch() reports a failure.
+  submit();
+
+  if (isLoopback())
+  {
+    _transfers++;
+    return _loopback.read(addr, reg, buf, len);
+  }
+
+  // Register select and read in one combined transfer (repeated START)
+  struct i2c_msg msgs[2];
+
+  msgs[0].addr = addr;
+  msgs[0].flags = 0;
+  msgs[0].len = 1;
+  msgs[0].buf = &reg;
+
+  msgs[1].addr = addr;
+  msgs[1].flags = I2C_M_RD;
+  msgs[1].len = len;
+  msgs[1].buf = buf;
+
+  return (transfer(msgs, 2) == AF_MS_BUS_OK) ? len : 0;
+}
+
+
+void AF_MS_LinuxI2CBus::delayMicroseconds(uint16_t us)
+{
+  struct timespec t;
+
+  t.tv_sec = 0;
+  t.tv_nsec = 1000L * us;
+
+  while (nanosleep(&t, &t) < 0 && errno == EINTR);
+}
+
+
+uint8_t AF_MS_LinuxI2CBus::submit(void)
+{
+  if (_count == 0) return AF_MS_BUS_OK;
+
+  uint8_t status;
+
+  if (isLoopback())
+  {
+    for (uint8_t i = 0; i < _count; i++)
+    {
+      _loopback.beginWrite(_msgs[i].addr);
+
+      for (uint16_t j = 0; j < _msgs[i].len; j++) _loopback.write(_msgs[i].buf[j]);
+
+      _loopback.endWrite();
+    }
+
+    _transfers++;
+    status = AF_MS_BUS_OK;
+  }
+  else
+  {
+    status = transfer(_msgs, _count);
+  }
+
+  _count = 0;
+  _used = 0;
+
+  if (_batchDepth > 0 && _batchStatus == AF_MS_BUS_OK) _batchStatus = status;
+
+  return status;
+}
+
+
+uint8_t AF_MS_LinuxI2CBus::transfer(struct i2c_msg* msgs, uint8_t count)
+{
+  if (_fd < 0) return AF_MS_BUS_ERROR;
+
+  struct i2c_rdwr_ioctl_data rdwr;
+
+  rdwr.msgs = msgs;
+  rdwr.nmsgs = count;
+
+  _transfers++;
+
+  if (ioctl(_fd, I2C_RDWR, &rdwr) < 0)
+  {
+    _error = errno;
+
+    switch (_error)
+    {
+      case ENXIO:
+      case EREMOTEIO:  return AF_MS_BUS_NACK_ADDR;
+      case ETIMEDOUT:  return AF_MS_BUS_TIMEOUT;
+      default:         return AF_MS_BUS_ERROR;
+    }
+  }
+
+  return AF_MS_BUS_OK;
+}
+
+#endif
@@ -0,0 +1,114 @@
+/***************************************************
+  Linux i2c-dev bus backend for the AF_MS_PWMServoDriver.
+
+  Drives the shields from a Linux single-board computer through /dev/i2c-N.
+  Every transaction written with beginWrite()/write()/endWrite() becomes an
+  i2c_msg. Outside a batch it is sent right away; between beginBatch() and
+  endBatch() the messages are collected and sent with a single I2C_RDWR
+  ioctl, so a burst of register writes costs one system call. The driver
+  batches its own flush() and setPWMBlock(); call beginBatch()/endBatch() on
+  the bus to group the writes of several shields on it.
+
+  endWrite() returns the status of the transfer it sent, if any. A batch that
+  fills up is sent early, by the endWrite() that filled it, and endBatch()
+  returns the first failure of any transfer sent since beginBatch(), as the
+  writes it carried are lost. A transaction longer than AF_MS_I2C_BUFFER_SIZE
+  is not sent: its endWrite() returns AF_MS_BUS_TOO_LONG.
+
+  The device is opened by begin(). The SCL clock cannot be changed from user
+  space (it is set in the device tree); clock() reports the adapter's clock
+  if the kernel exposes it.
+
+  Passing AF_MS_LINUX_I2C_LOOPBACK instead of a device path gives a loopback
+  bus: nothing is opened, and the messages are applied to an in-memory
+  PCA9685 register model (see loopback()) so the code can be exercised
+  without hardware. transfers() counts the ioctls that were, or in loopback
+  mode would have been, issued.
+
+  This header is included by AF_MS_I2CBus.h.
+
+  BSD license, all text above must be included in any redistribution
+ ****************************************************/
+
+#ifndef _AF_MS_LinuxI2CBus_H
+#define _AF_MS_LinuxI2CBus_H
+
+#include <linux/i2c.h>
+
+
+// Device opened by the default bus, AF_MS_LinuxBus. The Raspberry Pi header
+// is on /dev/i2c-1.
+#ifndef AF_MS_LINUX_I2C_DEVICE
+#define AF_MS_LINUX_I2C_DEVICE "/dev/i2c-1"
+#endif
+
+// Limits of one batched transfer. The kernel accepts at most 42 messages per
+// I2C_RDWR; a full batch is sent early.
+#ifndef AF_MS_LINUX_I2C_MAX_MSGS
+#define AF_MS_LINUX_I2C_MAX_MSGS 42
+#endif
+
+#ifndef AF_MS_LINUX_I2C_BATCH_SIZE
+#define AF_MS_LINUX_I2C_BATCH_SIZE 512     // Bytes of message data per batch
+#endif
+
+#define AF_MS_LINUX_I2C_LOOPBACK ((const char*)0)
+
+
+class AF_MS_LinuxI2CBus {
+ public:
+  AF_MS_LinuxI2CBus(const char* device);
+  ~AF_MS_LinuxI2CBus(void);
+
+  void begin(uint32_t clock);
+  uint32_t clock(void) { return _clock; }
+
+  void beginWrite(uint8_t addr);
+  void write(uint8_t d);
+  uint8_t endWrite(void);
+  uint8_t read(uint8_t addr, uint8_t reg, uint8_t* buf, uint8_t len);
+
+  // Messages only leave the process when a batch is submitted
+  bool idle(void) { return _count == 0; }
+  void flush(void) { submit(); }
+  void discard(void) { _count = 0; _used = 0; }
+  void delayMicroseconds(uint16_t us);
+  void beginBatch(void) { _batchDepth++; }
+  uint8_t endBatch(void);
+
+  // Recovery is done by the kernel adapter driver
+  bool recover(void) { return true; }
+
+  bool isOpen(void) { return _fd >= 0; }
+  bool isLoopback(void) { return _device == AF_MS_LINUX_I2C_LOOPBACK; }
+  const char* device(void) { return _device; }
+  AF_MS_RecordingBus& loopback(void) { return _loopback; }
+  uint32_t transfers(void) { return _transfers; }
+  int lastError(void) { return _error; }    // errno of the last failure, 0 if none
+
+ private:
+  const char* _device;
+  int _fd;
+  int _error;
+  uint32_t _clock;
+  uint32_t _transfers;
+  uint8_t _batchDepth;
+  uint8_t _count;                 // Messages collected, the last one may be open
+  uint16_t _used;                 // Bytes of _data in use
+  bool _overflow;                 // The open message did not fit the buffer
+  uint8_t _batchStatus;           // First failure of a transfer sent inside the batch
+  struct i2c_msg _msgs[AF_MS_LINUX_I2C_MAX_MSGS];
+  uint8_t _data[AF_MS_LINUX_I2C_BATCH_SIZE];
+  AF_MS_RecordingBus _loopback;
+
+  uint8_t submit(void);
+  uint8_t transfer(struct i2c_msg* msgs, uint8_t count);
+
+  // Not copyable: the collected messages point into _data
+  AF_MS_LinuxI2CBus(const AF_MS_LinuxI2CBus&);
+  AF_MS_LinuxI2CBus& operator=(const AF_MS_LinuxI2CBus&);
+};
+
+extern AF_MS_LinuxI2CBus AF_MS_LinuxBus;
+
+#endif
@@ -16,110 +16,488 @@
  ****************************************************/
 
 #include <AF_MS_PWMServoDriver.h>
-#include <Wire.h>
-#if defined(ARDUINO_SAM_DUE)
- #define WIRE Wire1
-#else
- #define WIRE Wire
-#endif
+#include <string.h>
 
 
-AF_MS_PWMServoDriver::AF_MS_PWMServoDriver(uint8_t addr) 
+AF_MS_PWMServoDriver::AF_MS_PWMServoDriver(uint8_t addr, AF_MS_Bus& bus) 
 {
+  _bus = &bus;
   _i2caddr = addr;
+  _oscFreq = PCA9685_OSC_FREQ;
+  _prescale = 0x1E;     // Power-on default (200 Hz at 25 MHz)
+  _warmStart = false;
+  _synced = 0;
+  _dirty = 0;
+  _frameBody = 0;
+  _retryLimit = AF_MS_RETRY_LIMIT;
+  _lastError = AF_MS_BUS_OK;
+  resetStats();
 }
 
 
-void AF_MS_PWMServoDriver::begin(void) 
+void AF_MS_PWMServoDriver::begin(uint32_t i2cClock) 
 {
- WIRE.begin();
- reset();
+ if (i2cClock > 1000000) i2cClock = 1000000;   // Fast-mode Plus is the PCA9685 limit
+
+ _bus->begin(i2cClock);
+
+ // MODE1 is deliberately left alone here so that setPWMFreq() can tell
+ // whether the chip is still configured from before an MCU reset.
+ invalidate();
 }
 
 
 void AF_MS_PWMServoDriver::reset(void) 
 {
  write8(PCA9685_MODE1, 0x0);
+ invalidate();
 }
 
 
-void AF_MS_PWMServoDriver::setPWMFreq(float freq) 
+uint16_t AF_MS_PWMServoDriver::setPWMFreq(uint16_t freq) 
 {
   //Serial.print("Attempting to set freq ");
   //Serial.println(freq);
-  
-  freq *= 0.9;  // Correct for overshoot in the frequency setting (see issue #11).
-
-  float prescaleval = 25000000;
-  prescaleval /= 4096;
-  prescaleval /= freq;
-  prescaleval -= 1;
-  //Serial.print("Estimated pre-scale: "); Serial.println(prescaleval);
-  uint8_t prescale = floor(prescaleval + 0.5);
+
+  if (freq == 0) freq = 1;
+
+  // The output frequency is osc / (4096 * (prescale + 1)). Start from the
+  // divider rounded down, then take the next one if its frequency is nearer.
+  uint32_t div = _oscFreq / (4096UL * freq);
+
+  if (div < 1) div = 1;
+
+  uint32_t fHi = _oscFreq / (4096UL * div);
+  uint32_t fLo = _oscFreq / (4096UL * (div + 1));
+
+  if ((int32_t)(fHi - freq) > (int32_t)(freq - fLo)) div++;
+
+  if (div < 4) div = 4;             // PRESCALE is limited to 3..255
+  if (div > 256) div = 256;
+  uint8_t prescale = div - 1;
   //Serial.print("Final pre-scale: "); Serial.println(prescale);  
   
   uint8_t oldmode = read8(PCA9685_MODE1);
-  uint8_t newmode = (oldmode&0x7F) | 0x10; // sleep
-  write8(PCA9685_MODE1, newmode); // go to sleep
-  write8(PCA9685_PRESCALE, prescale); // set the prescaler
-  write8(PCA9685_MODE1, oldmode);
-  delay(5);
-  write8(PCA9685_MODE1, oldmode | 0xa1);  //  This sets the MODE1 register to turn on auto increment.
-                                          // This is why the beginTransmission below was not working.
+
+  // Warm start: if the MCU was only reset, the chip may still be awake with
+  // auto-increment on and this prescaler, in which case there is nothing to do.
+  _warmStart = !(oldmode & PCA9685_MODE1_SLEEP) && (oldmode & PCA9685_MODE1_AI)
+               && read8(PCA9685_PRESCALE) == prescale;
+
+  if (!_warmStart)
+  {
+    // PRESCALE can only be written while the oscillator is asleep. The chip
+    // comes out of power-on asleep, so SLEEP is cleared from the old mode.
+    uint8_t awake = oldmode & ~(PCA9685_MODE1_RESTART | PCA9685_MODE1_SLEEP);
+
+    write8(PCA9685_MODE1, awake | PCA9685_MODE1_SLEEP); // go to sleep
+    write8(PCA9685_PRESCALE, prescale); // set the prescaler
+    write8(PCA9685_MODE1, awake);
+    waitForBus();
+    _bus->delayMicroseconds(500);   // Oscillator start-up time from the data sheet
+
+    // Setting RESTART resumes any PWM channels that were running before the
+    // sleep; this also turns on auto increment and ALLCALL.
+    write8(PCA9685_MODE1, awake | PCA9685_MODE1_RESTART | PCA9685_MODE1_AI | PCA9685_MODE1_ALLCALL);
+  }
   //  Serial.print("Mode now 0x"); Serial.println(read8(PCA9685_MODE1), HEX);
+
+  _prescale = prescale;
+
+  return getPWMFreq();
 }
 
 
-void AF_MS_PWMServoDriver::setPWM(uint8_t num, uint16_t on, uint16_t off) 
+uint16_t AF_MS_PWMServoDriver::getPWMFreq(void) 
+{
+  uint32_t div = 4096UL * (_prescale + 1);
+
+  return (_oscFreq + div / 2) / div;
+}
+
+
+bool AF_MS_PWMServoDriver::setPWM(uint8_t num, uint16_t on, uint16_t off) 
 {
   //Serial.print("Setting PWM "); Serial.print(num); Serial.print(": "); Serial.print(on); Serial.print("->"); Serial.println(off);
 
-  WIRE.beginTransmission(_i2caddr);
-#if ARDUINO >= 100
-  WIRE.write(LED0_ON_L+4*num);
-  WIRE.write(on);
-  WIRE.write(on>>8);
-  WIRE.write(off);
-  WIRE.write(off>>8);
-#else
-  WIRE.send(LED0_ON_L+4*num);
-  WIRE.send((uint8_t)on);
-  WIRE.send((uint8_t)(on>>8));
-  WIRE.send((uint8_t)off);
-  WIRE.send((uint8_t)(off>>8));
-#endif
-  WIRE.endTransmission();
+  uint16_t mask = 1U << num;
+
+  // Skip the transaction if the chip already holds this value
+  if ((_synced & mask) && _on[num] == on && _off[num] == off) return true;
+
+  return writeLEDs(num, 1, &on, &off);
+}
+
+
+bool AF_MS_PWMServoDriver::setPWMBlock(uint8_t first, uint8_t count, const uint16_t* on, const uint16_t* off) 
+{
+  if (first >= 16 || count > 16 - first) return false;
+
+  // Trim channels at either end of the block that the chip already holds
+  while (count > 0 && (_synced & (1U << first)) && _on[first] == on[0] && _off[first] == off[0])
+  {
+    first++; on++; off++; count--;
+  }
+
+  while (count > 0)
+  {
+    uint8_t last = first + count - 1;
+
+    if (!(_synced & (1U << last)) || _on[last] != on[count-1] || _off[last] != off[count-1]) break;
+
+    count--;
+  }
+
+  // Send the remainder in as few transactions as the Wire buffer allows
+  bool ok = true;
+
+  beginBatch();
+
+  while (count > 0)
+  {
+    uint8_t n = (count > PCA9685_MAX_BURST) ? PCA9685_MAX_BURST : count;
+
+    ok &= writeLEDs(first, n, on, off);
+    first += n; on += n; off += n; count -= n;
+  }
+
+  return endBatch() && ok;
+}
+
+
+bool AF_MS_PWMServoDriver::setAllPWM(uint16_t on, uint16_t off) 
+{
+  uint8_t b[4] = { (uint8_t)on, (uint8_t)(on>>8), (uint8_t)off, (uint8_t)(off>>8) };
+  bool ok = transmit(ALLLED_ON_L, b, sizeof(b));
+
+  for (uint8_t num = 0; num < 16; num++)
+  {
+    _on[num] = on;
+    _off[num] = off;
+  }
+
+  _synced = ok ? 0xFFFF : 0;
+  _dirty = 0;
+  _frameBody = 0;
+
+  return ok;
+}
+
+
+void AF_MS_PWMServoDriver::stagePWM(uint8_t num, uint16_t on, uint16_t off) 
+{
+  uint16_t mask = 1U << num;
+
+  if ((_synced & mask) && _on[num] == on && _off[num] == off) return;
+
+  _on[num] = on;
+  _off[num] = off;
+  _synced &= ~mask;
+  _dirty |= mask;
+}
+
+
+bool AF_MS_PWMServoDriver::flush(void) 
+{
+  bool ok = true;
+
+  beginBatch();
+
+  while (_dirty)
+  {
+    uint8_t first = 0;
+
+    while (!(_dirty & (1U << first))) first++;
+
+    // Extend the run up to the last dirty channel that still fits in one
+    // transaction. Clean channels in between are re-sent from the shadow, which
+    // is cheaper than a new transaction, but only if their value is known.
+    uint8_t last = first;
+    uint8_t num;
+
+    for (num = first + 1; num < 16 && num - first < PCA9685_MAX_BURST; num++)
+    {
+      uint16_t mask = 1U << num;
+
+      if (_dirty & mask)
+        last = num;
+      else if (!(_synced & mask))
+        break;
+    }
+
+    // If the burst limit cut a frame in two, end the run before that frame
+    // so that it goes out whole in the next transaction.
+    if (num < 16 && (_frameBody & (1U << num)))
+    {
+      uint8_t head = num;
+
+      while (_frameBody & (1U << head)) head--;
+
+      if (head > first)
+      {
+        last = head - 1;
+
+        while (!(_dirty & (1U << last))) last--;
+      }
+    }
+
+    ok &= writeLEDs(first, last - first + 1, &_on[first], &_off[first]);
+  }
+
+  _frameBody = 0;
+
+  return endBatch() && ok;
+}
+
+
+void AF_MS_PWMServoDriver::stageFrame(uint8_t first, uint8_t count, const uint16_t* on, const uint16_t* off) 
+{
+  if (first >= 16 || count > 16 - first) return;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    stagePWM(first + i, on[i], off[i]);
+
+    if (i > 0) _frameBody |= 1U << (first + i);
+  }
+}
+
+
+void AF_MS_PWMServoDriver::setSubAddress(uint8_t index, uint8_t addr) 
+{
+  static const uint8_t enable[] = { PCA9685_MODE1_SUB1, PCA9685_MODE1_SUB2, PCA9685_MODE1_SUB3 };
+
+  if (index < 1 || index > 3) return;
+
+  write8(PCA9685_SUBADR1 + index - 1, addr << 1);   // Register holds the 8-bit form
+  write8(PCA9685_MODE1, read8(PCA9685_MODE1) | enable[index - 1]);
+}
+
+
+void AF_MS_PWMServoDriver::setAllCallAddress(uint8_t addr) 
+{
+  write8(PCA9685_ALLCALLADR, addr << 1);
+  write8(PCA9685_MODE1, read8(PCA9685_MODE1) | PCA9685_MODE1_ALLCALL);
+}
+
+
+void AF_MS_PWMServoDriver::assumeWritten(const AF_MS_PWMServoDriver& src, uint16_t mask) 
+{
+  mask &= ~_dirty;
+
+  for (uint8_t num = 0; num < 16; num++)
+  {
+    if (!(mask & (1U << num))) continue;
+
+    _on[num] = src._on[num];
+    _off[num] = src._off[num];
+  }
+
+  _synced |= mask;
+}
+
+
+void AF_MS_PWMServoDriver::discardStaged(void) 
+{
+  _dirty = 0;
+  _frameBody = 0;
+}
+
+
+bool AF_MS_PWMServoDriver::writeLEDs(uint8_t first, uint8_t count, const uint16_t* on, const uint16_t* off) 
+{
+  uint8_t b[4*PCA9685_MAX_BURST] = { 0 };
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    b[4*i]   = on[i];
+    b[4*i+1] = on[i]>>8;
+    b[4*i+2] = off[i];
+    b[4*i+3] = off[i]>>8;
+  }
+
+  bool ok = transmit(LED0_ON_L+4*first, b, 4*count);
+
+  // After a failure the chip may hold the old or the new value
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint16_t mask = 1U << (first+i);
+
+    _on[first+i] = on[i];
+    _off[first+i] = off[i];
+    _dirty &= ~mask;
+
+    if (ok)
+      _synced |= mask;
+    else
+      _synced &= ~mask;
+  }
+
+  return ok;
+}
+
+
+void AF_MS_PWMServoDriver::invalidate(void) 
+{
+  _synced = 0;
+}
+
+
+void AF_MS_PWMServoDriver::resync(void) 
+{
+  // Read the LEDn registers back 8 channels (32 bytes) at a time, which is the
+  // most the Wire receive buffer can hold. This relies on MODE1 auto-increment.
+  uint8_t mode = read8(PCA9685_MODE1);
+
+  if (!(mode & PCA9685_MODE1_AI)) write8(PCA9685_MODE1, (mode & ~PCA9685_MODE1_RESTART) | PCA9685_MODE1_AI);
+
+  _synced = 0;
+
+  for (uint8_t first = 0; first < 16; first += 8)
+  {
+    uint8_t b[32];
+
+    if (!readBytes(LED0_ON_L+4*first, b, sizeof(b))) continue;   // These stay unknown
+
+    _synced |= 0xFFU << first;
+
+    for (uint8_t num = first; num < first + 8; num++)
+    {
+      uint8_t* r = &b[4*(num - first)];
+
+      if (_dirty & (1U << num)) continue;   // Keep values staged for the next flush()
+
+      _on[num]  = (r[0] | (r[1] << 8)) & 0x1FFF;
+      _off[num] = (r[2] | (r[3] << 8)) & 0x1FFF;
+    }
+  }
+
+  _synced &= ~_dirty;
+}
+
+
+bool AF_MS_PWMServoDriver::endBatch(void) 
+{
+  uint8_t status = _bus->endBatch();
+
+  if (status == AF_MS_BUS_OK) return true;
+
+  // The batch went out as one transfer and cannot be repeated piecemeal, so
+  // whatever it carried is no longer known to be on the chip.
+  _lastError = status;
+  countError(status);
+  _stats.failures++;
+  invalidate();
+
+  return false;
+}
+
+
+void AF_MS_PWMServoDriver::resetStats(void) 
+{
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+
+bool AF_MS_PWMServoDriver::recoverBus(void) 
+{
+  _stats.recoveries++;
+
+  return _bus->recover();
+}
+
+
+void AF_MS_PWMServoDriver::countError(uint8_t status) 
+{
+  if (status == AF_MS_BUS_NACK_ADDR || status == AF_MS_BUS_NACK_DATA)
+  {
+    _stats.nacks++;
+  }
+  else if (status == AF_MS_BUS_TIMEOUT)
+  {
+    _stats.timeouts++;
+    recoverBus();
+  }
+  else
+  {
+    _stats.errors++;
+
+    if (status == AF_MS_BUS_ERROR) recoverBus();
+  }
+}
+
+
+bool AF_MS_PWMServoDriver::transmit(uint8_t reg, const uint8_t* data, uint8_t len) 
+{
+  for (uint8_t attempt = 0; ; attempt++)
+  {
+    _bus->beginWrite(_i2caddr);
+    _bus->write(reg);
+
+    for (uint8_t i = 0; i < len; i++) _bus->write(data[i]);
+
+    _lastError = _bus->endWrite();
+    _stats.transactions++;
+    _stats.bytes += len + 2;          // Address, register and data
+
+    if (_lastError == AF_MS_BUS_OK) return true;
+
+    countError(_lastError);
+
+    // A transaction too long for the bus never fits, however often it is sent
+    if (_lastError == AF_MS_BUS_TOO_LONG || attempt >= _retryLimit) break;
+
+    _stats.retries++;
+  }
+
+  _stats.failures++;
+
+  return false;
+}
+
+
+bool AF_MS_PWMServoDriver::readBytes(uint8_t reg, uint8_t* buf, uint8_t len) 
+{
+  for (uint8_t attempt = 0; ; attempt++)
+  {
+    uint8_t n = _bus->read(_i2caddr, reg, buf, len);
+
+    _stats.transactions += 2;         // Register select, then the read
+    _stats.bytes += 3 + n;
+
+    if (n == len)
+    {
+      _lastError = AF_MS_BUS_OK;
+      return true;
+    }
+
+    // Wire does not say why a read came back short; it is nearly always
+    // an unacknowledged address.
+    _lastError = AF_MS_BUS_NACK_ADDR;
+    _stats.nacks++;
+
+    if (attempt >= _retryLimit) break;
+
+    _stats.retries++;
+  }
+
+  _stats.failures++;
+
+  return false;
 }
 
 
 uint8_t AF_MS_PWMServoDriver::read8(uint8_t addr) 
 {
-  WIRE.beginTransmission(_i2caddr);
-#if ARDUINO >= 100
-  WIRE.write(addr);
-#else
-  WIRE.send(addr);
-#endif
-  WIRE.endTransmission();
-
-  WIRE.requestFrom((uint8_t)_i2caddr, (uint8_t)1);
-#if ARDUINO >= 100
-  return WIRE.read();
-#else
-  return WIRE.receive();
-#endif
-}
-
-
-void AF_MS_PWMServoDriver::write8(uint8_t addr, uint8_t d) 
-{
-  WIRE.beginTransmission(_i2caddr);
-#if ARDUINO >= 100
-  WIRE.write(addr);
-  WIRE.write(d);
-#else
-  WIRE.send(addr);
-  WIRE.send(d);
-#endif
-  WIRE.endTransmission();
+  uint8_t d = 0;
+
+  readBytes(addr, &d, 1);
+
+  return d;
+}
+
+
+bool AF_MS_PWMServoDriver::write8(uint8_t addr, uint8_t d) 
+{
+  return transmit(addr, &d, 1);
 }
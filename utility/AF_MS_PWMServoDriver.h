@@ -18,20 +18,33 @@
 #ifndef _AF_MS_PWMServoDriver_H
 #define _AF_MS_PWMServoDriver_H
 
-#if ARDUINO >= 100
- #include "Arduino.h"
-#else
- #include "WProgram.h"
-#endif
+#include "AF_MS_I2CBus.h"
 
 
 #define PCA9685_SUBADR1 0x2
 #define PCA9685_SUBADR2 0x3
 #define PCA9685_SUBADR3 0x4
+#define PCA9685_ALLCALLADR 0x5
 
 #define PCA9685_MODE1 0x0
+#define PCA9685_MODE2 0x1
 #define PCA9685_PRESCALE 0xFE
 
+// MODE1 bits
+#define PCA9685_MODE1_ALLCALL 0x01
+#define PCA9685_MODE1_SUB3 0x02
+#define PCA9685_MODE1_SUB2 0x04
+#define PCA9685_MODE1_SUB1 0x08
+#define PCA9685_MODE1_SLEEP 0x10
+#define PCA9685_MODE1_AI 0x20
+#define PCA9685_MODE1_RESTART 0x80
+
+// MODE2 bits
+#define PCA9685_MODE2_OUTNE 0x03
+#define PCA9685_MODE2_OUTDRV 0x04   // Totem-pole outputs (power-on default)
+#define PCA9685_MODE2_OCH 0x08      // Outputs change on ACK instead of on STOP
+#define PCA9685_MODE2_INVRT 0x10
+
 #define LED0_ON_L 0x6
 #define LED0_ON_H 0x7
 #define LED0_OFF_L 0x8
@@ -42,20 +55,163 @@
 #define ALLLED_OFF_L 0xFC
 #define ALLLED_OFF_H 0xFD
 
+#define PCA9685_MAX_BURST ((AF_MS_I2C_BUFFER_SIZE - 1) / 4)
+
+// Frequency of the PCA9685 internal oscillator, used to compute PRESCALE.
+// The data sheet says 25 MHz, but the parts on the shield run fast (see
+// issue #11); this value reproduces the 0.9 correction the float code used.
+// Use setOscillatorFreq() to calibrate an individual board.
+#ifndef PCA9685_OSC_FREQ
+#define PCA9685_OSC_FREQ 27777778UL
+#endif
+
+
+// Bus health counters of one driver. Every attempt is counted, so a
+// transaction that succeeds on its second try adds 2 to transactions, 1 to
+// retries and 1 to nacks, timeouts or errors.
+struct AF_MS_BusStats {
+  uint32_t transactions;  // Write and read transactions attempted
+  uint32_t bytes;         // Bytes on the wire, including address bytes
+  uint16_t nacks;         // Attempts the chip did not acknowledge
+  uint16_t timeouts;      // Attempts that timed out
+  uint16_t errors;        // Attempts that ended in any other error: bus error, too long
+  uint16_t retries;       // Attempts repeated after an error
+  uint16_t failures;      // Transactions given up after the last retry
+  uint16_t recoveries;    // Bus recovery sequences run
+};
+
+// Number of times a failed transaction is repeated
+#ifndef AF_MS_RETRY_LIMIT
+#define AF_MS_RETRY_LIMIT 2
+#endif
+
 
 class AF_MS_PWMServoDriver {
  public:
-  AF_MS_PWMServoDriver(uint8_t addr = 0x40);
-  void begin(void);
+  // The bus is resolved at compile time (see AF_MS_I2CBus.h); bus selects the
+  // instance, e.g. AF_MS_Wire or AF_MS_Wire1.
+  AF_MS_PWMServoDriver(uint8_t addr = 0x40, AF_MS_Bus& bus = AF_MS_DEFAULT_BUS);
+  // Starts the I2C bus with the given SCL clock. The PCA9685 supports
+  // Standard-mode (100 kHz), Fast-mode (400 kHz) and Fast-mode Plus (1 MHz).
+  // Since the clock is shared by the whole bus, the last call wins.
+  void begin(uint32_t i2cClock = 100000);
+  uint32_t getI2CClock(void) { return _bus->clock(); }
+  AF_MS_Bus& getBus(void) { return *_bus; }
   void reset(void);
-  void setPWMFreq(float freq);
-  void setPWM(uint8_t num, uint16_t on, uint16_t off);
+  // Programs the prescaler for the achievable frequency nearest to freq and
+  // returns it. getPWMFreq() returns the frequency the programmed PRESCALE
+  // gives with the oscillator calibration below.
+  //
+  // If the chip is already awake with this prescaler (the MCU was reset but the
+  // board kept power), setPWMFreq() skips the sleep/wake cycle, leaves the
+  // outputs running and isWarmStart() returns true.
+  uint16_t setPWMFreq(uint16_t freq);
+  bool isWarmStart(void) { return _warmStart; }
+  uint16_t getPWMFreq(void);
+  void setOscillatorFreq(uint32_t freq) { _oscFreq = freq; }
+
+  // MODE2 output configuration. With PCA9685_MODE2_OCH clear (the default)
+  // outputs change on the I2C STOP, so every channel written in a transaction
+  // switches at the same time; with it set, each channel changes as soon as
+  // its registers are acknowledged.
+  void setMode2(uint8_t mode) { write8(PCA9685_MODE2, mode); }
+  uint8_t getMode2(void) { return read8(PCA9685_MODE2); }
+  uint32_t getOscillatorFreq(void) { return _oscFreq; }
+
+  // Writes return false if the transaction still failed after the retries
+  // (see below). The channels concerned are then marked unknown, so the next
+  // write of the same value is not skipped.
+  bool setPWM(uint8_t num, uint16_t on, uint16_t off);
+
+  // Sets count consecutive channels starting at first using auto-increment
+  // burst writes, PCA9685_MAX_BURST channels per transaction. A block that
+  // runs past channel 15 is rejected.
+  bool setPWMBlock(uint8_t first, uint8_t count, const uint16_t* on, const uint16_t* off);
+
+  // Sets all 16 channels at once through the ALL_LED registers (one 6-byte
+  // transaction). Any staged values are discarded.
+  bool setAllPWM(uint16_t on, uint16_t off);
+
+  // Deferred writes: stagePWM() only records the new value and marks the
+  // channel dirty; flush() sends all dirty channels in as few burst
+  // transactions as possible.
+  void stagePWM(uint8_t num, uint16_t on, uint16_t off);
+  bool flush(void);
+
+  // Stages count consecutive channels as one frame. flush() keeps a frame in
+  // a single transaction (if it fits in one), so with outputs changing on
+  // STOP all its channels switch together.
+  void stageFrame(uint8_t first, uint8_t count, const uint16_t* on, const uint16_t* off);
+  bool isDirty(void) { return _dirty != 0; }
+  uint16_t dirtyMask(void) { return _dirty; }
+
+  // Group addressing: programs one of the three sub-addresses (index 1-3) or
+  // the ALLCALL address, as a 7-bit address, and enables it in MODE1.
+  void setSubAddress(uint8_t index, uint8_t addr);
+  void setAllCallAddress(uint8_t addr);
+
+  // Records that the channels in mask now hold the values in src's shadow,
+  // because src wrote them to this chip through a group address. Channels with
+  // staged values keep them.
+  void assumeWritten(const AF_MS_PWMServoDriver& src, uint16_t mask);
+  void discardStaged(void);
+
+  // The driver keeps a shadow copy of the 16 LEDn_ON/OFF register pairs so
+  // that setPWM() can skip transactions whose value is already on the chip.
+  // invalidate() forgets the shadow (e.g. after something else has written to
+  // the chip); resync() reloads it from the chip.
+  void invalidate(void);
+  void resync(void);
+
+  // With an asynchronous bus, writes complete in the background. isBusIdle()
+  // tells whether everything queued has been sent; waitForBus() waits for it.
+  // discardQueued() drops the writes that have not started yet; the channels
+  // they carried are then no longer known to be on the chip.
+  bool isBusIdle(void) { return _bus->idle(); }
+  void waitForBus(void) { _bus->flush(); }
+  void discardQueued(void) { _bus->discard(); invalidate(); }
+
+  // Batching: on buses that support it (Linux i2c-dev), the transactions
+  // written between beginBatch() and endBatch() are sent in one transfer.
+  // flush() and setPWMBlock() batch their own writes. Calls nest.
+  void beginBatch(void) { _bus->beginBatch(); }
+  bool endBatch(void);
+
+  // Error handling: a failed transaction is repeated up to the retry limit,
+  // unless it is too long for the bus (AF_MS_BUS_TOO_LONG). Bus errors and
+  // timeouts also run the bus recovery sequence before the next attempt.
+  // getLastError() is the status of the last transaction (AF_MS_BUS_OK or an
+  // AF_MS_BUS_* error code). On an asynchronous bus, writes fail after they
+  // return; those are counted by the bus itself.
+  void setRetryLimit(uint8_t retries) { _retryLimit = retries; }
+  uint8_t getRetryLimit(void) { return _retryLimit; }
+  uint8_t getLastError(void) { return _lastError; }
+  const AF_MS_BusStats& getStats(void) { return _stats; }
+  void resetStats(void);
+  bool recoverBus(void);
 
  private:
+  AF_MS_Bus* _bus;
   uint8_t _i2caddr;
+  uint32_t _oscFreq;    // Oscillator calibration in Hz
+  uint8_t _prescale;    // Last value programmed into PRESCALE
+  bool _warmStart;      // setPWMFreq() found the chip already configured
+  uint16_t _synced;     // Bit n is set when _on[n]/_off[n] match the chip
+  uint16_t _dirty;      // Bit n is set when _on[n]/_off[n] are staged but not yet written
+  uint16_t _frameBody;  // Bit n is set when channel n continues the staged frame of channel n-1
+  uint16_t _on[16];     // Shadow of LEDn_ON_L/H
+  uint16_t _off[16];    // Shadow of LEDn_OFF_L/H
+
+  uint8_t _retryLimit;
+  uint8_t _lastError;
+  AF_MS_BusStats _stats;
 
   uint8_t read8(uint8_t addr);
-  void write8(uint8_t addr, uint8_t d);
+  bool write8(uint8_t addr, uint8_t d);
+  bool transmit(uint8_t reg, const uint8_t* data, uint8_t len);
+  bool readBytes(uint8_t reg, uint8_t* buf, uint8_t len);
+  bool writeLEDs(uint8_t first, uint8_t count, const uint16_t* on, const uint16_t* off);
+  void countError(uint8_t status);
 };
 
 #endif